@@ -0,0 +1,109 @@
+#pragma once
+
+#include "../types.h"
+#include "comm_handler.h"
+#include "mesh.h"
+
+#include <pthread.h>
+
+/// Identifies a checkpoint file.
+#define CHECKPOINT_MAGIC "TOPCKPT"
+/// Version of the format of the checkpoint files, checked on restart.
+#define CHECKPOINT_VERSION 1
+/// Size (in bytes) of the header of a checkpoint file, a page so that the meshes after it can be
+/// mapped in place.
+#define CHECKPOINT_HEADER_SIZE 4096
+
+/// Header of the checkpoint file of a rank, all fields are 64-bit integers in the byte order of
+/// the machine (as are the values).
+/// The storage of the current iterate then of the constant mesh follow it, as laid out in memory
+/// (ghost cells and padding included), each starting on a page boundary.
+typedef struct checkpoint_header_s {
+    char magic[8];
+    u64 version;
+    /// Number of iterations computed.
+    u64 iteration;
+    /// Number of ranks of the run, and rank of the file.
+    u64 nb_ranks;
+    u64 rank;
+    /// Dimensions of the global mesh, and position and dimensions of the local one in it.
+    u64 global_dims[3];
+    u64 coords[3];
+    u64 loc_dims[3];
+    /// Layout of the meshes (see `mesh_t`), and size and offset in the file of their storage.
+    u64 order;
+    u64 ghost;
+    u64 stride_x;
+    u64 stride_y;
+    u64 mesh_size;
+    u64 offsets[2];
+} checkpoint_header_t;
+
+/// Periodic checkpoints of the solver state, one file per rank.
+/// The current iterate is copied into a staging buffer, then written with the constant mesh by a
+/// background thread, so that the iterations go on during the write. A checkpoint is written to a
+/// temporary file and renamed over the previous one once complete: a crash during the write leaves
+/// the previous checkpoint of the rank intact (but possibly older than the ones of other ranks,
+/// which a restart detects).
+typedef struct checkpoint_s {
+    /// Prefix of the files, and file of the local rank.
+    char const* path;
+    char* file_path;
+    checkpoint_header_t header;
+    /// Copy of the current iterate being written, and constant mesh written with it (not copied,
+    /// it must live until the write completes).
+    f64* staging;
+    usz capacity;
+    mesh_t const* constant;
+    /// Thread writing the checkpoint in flight, if running.
+    bool running;
+    pthread_t thread;
+} checkpoint_t;
+
+/// State of the solver restored from checkpoints.
+typedef struct checkpoint_restart_s {
+    /// Number of iterations computed.
+    usz iteration;
+    /// Whether the storage of the meshes maps the checkpoint of the local rank. Otherwise, `A` and
+    /// `B` hold the core cells of the local meshes gathered from the checkpoints overlapping them,
+    /// to be copied (see `mesh_copy_core`) into the meshes once initialized.
+    bool mapped;
+    mesh_t A;
+    mesh_t B;
+} checkpoint_restart_t;
+
+/// Prepares the checkpoints of the local rank into the files `path.RANK`.
+checkpoint_t checkpoint_new(comm_handler_t const* comm_handler, char const path[static 1]);
+
+/// Starts writing `curr` (the iterate after `iteration` iterations) and the constant mesh `B`,
+/// once the checkpoint in flight is written, from a single thread. `B` must not be modified nor
+/// dropped until `checkpoint_wait`.
+void checkpoint_write(
+    checkpoint_t* self,
+    comm_handler_t const* comm_handler,
+    mesh_t const* curr,
+    mesh_t const* B,
+    usz iteration
+);
+
+/// Waits for the checkpoint in flight to be written.
+void checkpoint_wait(checkpoint_t* self);
+
+/// Waits for the checkpoint in flight to be written and releases the staging buffer.
+void checkpoint_drop(checkpoint_t* self);
+
+/// Restores the input mesh `A` and the constant mesh `B` from the checkpoints `path.RANK`.
+/// If the checkpoint of the local rank has the same layout as its meshes, it is mapped privately
+/// in place of their storage (the meshes must then not be initialized again). Otherwise, the
+/// checkpoints may come from another number of ranks or split: the core cells of the local meshes
+/// are gathered from all the checkpoints overlapping them. Collective over the ranks.
+checkpoint_restart_t checkpoint_restart(
+    comm_handler_t const* comm_handler,
+    char const path[static 1],
+    mesh_t* A,
+    mesh_t* B,
+    mesh_alloc_t alloc
+);
+
+/// Releases the meshes gathered by `checkpoint_restart`.
+void checkpoint_restart_drop(checkpoint_restart_t* self);
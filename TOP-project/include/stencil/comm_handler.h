@@ -4,16 +4,124 @@
 #include "types.h"
 
 #include <mpi.h>
+#include <pthread.h>
 
-/// Enum for communication kind (either a send or a receive operation).
-typedef enum comm_kind_e {
-    COMM_KIND_SEND_OP,
-    COMM_KIND_RECV_OP,
-} comm_kind_t;
-typedef int MPI_Syncfunc_t(MPI_Comm);
+/// Maximum number of meshes whose ghost cells are exchanged through a handler.
+#define COMM_MAX_HALOS 4
+
+/// Number of faces of a local mesh, each one sent to and received from at most one neighbor.
+#define COMM_NB_FACES 6
+
+/// MPI operations exchanging the ghost cells.
+typedef enum comm_exchange_e {
+    /// Persistent point-to-point requests, one per face and direction.
+    COMM_EXCHANGE_P2P,
+    /// A single neighborhood collective (`MPI_Ineighbor_alltoallw`) over the Cartesian
+    /// communicator, which synchronizes with the face neighbors only.
+    COMM_EXCHANGE_NEIGHBOR,
+    /// Meshes allocated with `comm_handler_mesh_new` live in shared-memory windows of the node:
+    /// faces of the neighbors on the node are copied directly from their meshes, the others are
+    /// exchanged with persistent point-to-point requests.
+    COMM_EXCHANGE_SHARED,
+} comm_exchange_t;
+
+/// Where the weights of the ranks in the split of the mesh come from.
+typedef enum comm_balance_e {
+    /// All ranks get the same share.
+    COMM_BALANCE_EVEN,
+    /// Shares follow the throughput of a short calibration sweep on every rank.
+    COMM_BALANCE_CALIBRATE,
+    /// Shares follow the weights read from a file, one line per rank.
+    COMM_BALANCE_FILE,
+} comm_balance_t;
+
+/// Ghost cells copied from the mesh of a neighbor on the same node.
+typedef struct comm_copy_s {
+    /// First cell of the region in the mesh of the neighbor and in the local one.
+    f64 const* src;
+    f64* dst;
+    /// Extents of the region.
+    usz nb_x;
+    usz nb_y;
+    usz nb_z;
+    /// Strides of the mesh of the neighbor and of the local one.
+    usz src_stride_x;
+    usz src_stride_y;
+    usz dst_stride_x;
+    usz dst_stride_y;
+    /// Synchronization flags of the neighbor (see `comm_handler_t`).
+    u64 const* flags;
+} comm_copy_t;
+
+/// Mesh allocated in a shared-memory window of the node.
+typedef struct comm_window_s {
+    /// Values of the local mesh, NULL once the window is freed.
+    f64 const* values;
+    MPI_Win win;
+    /// Meshes of the neighbors on the node, in face order (without values if the neighbor is
+    /// absent or on another node).
+    mesh_t peers[COMM_NB_FACES];
+} comm_window_t;
+
+/// Persistent exchange of the ghost cells of a mesh.
+/// Each face is described by a datatype covering exactly the ghost region (over the core cells of
+/// the other axes), so that an exchange is one message per face and direction.
+typedef struct comm_halo_s {
+    /// Values of the exchanged mesh, which identify it.
+    f64 const* values;
+    /// Whether the ghost layers are deeper than the order of the stencil: faces then also span
+    /// the ghost cells of the axes before theirs, and axes are exchanged one after the other.
+    bool deep;
+    /// Datatypes of the faces orthogonal to the X, Y and Z axes.
+    MPI_Datatype faces[3];
+    /// Persistent send and receive requests, restarted at every exchange (point-to-point), and
+    /// end of the requests of each axis.
+    i32 nb_requests;
+    MPI_Request requests[2 * COMM_NB_FACES];
+    i32 axis_requests[3];
+    /// Bytes and faces sent to the neighbors by an exchange (see `instrument.h`).
+    u64 sent_bytes;
+    u64 nb_sent;
+    /// Arguments of the neighborhood collective, in the neighbor order of the Cartesian
+    /// communicator (low then high side of X, Y and Z). Displacements are absolute addresses.
+    i32 counts[COMM_NB_FACES];
+    MPI_Aint send_displs[COMM_NB_FACES];
+    MPI_Aint recv_displs[COMM_NB_FACES];
+    MPI_Datatype types[COMM_NB_FACES];
+    /// Request of the neighborhood collective in flight.
+    MPI_Request collective;
+    /// Faces copied from the neighbors on the node (shared-memory exchange).
+    usz nb_copies;
+    comm_copy_t copies[COMM_NB_FACES];
+} comm_halo_t;
+
+/// Thread driving the progress of the exchanges in flight, so that they advance while all the
+/// threads of the team compute (see `comm_handler_progress_start`).
+typedef struct comm_progress_s {
+    /// Whether the thread runs.
+    bool running;
+    pthread_t thread;
+    /// Private duplicate of the communicator, probed to drive the progress engine of MPI.
+    MPI_Comm comm;
+    /// CPU the thread is pinned to, -1 if none.
+    i32 cpu;
+    /// Number of exchanges in flight, and whether the thread must stop (accessed atomically).
+    u32 in_flight;
+    bool stop;
+} comm_progress_t;
 
 /// Handler for MPI communications between neighboor processes (ghost cell exchanges).
 typedef struct comm_handler_s {
+    /// Cartesian communicator of the ranks, and rank of the local mesh in it.
+    MPI_Comm comm;
+    i32 rank;
+    comm_exchange_t exchange;
+    /// Dimensions of the global mesh, and minimum number of cells of the local meshes along each
+    /// axis (the width of the ghost layers).
+    usz dim_x;
+    usz dim_y;
+    usz dim_z;
+    usz min_dim;
     /// Number of local meshes on the X axis.
     u32 nb_x;
     /// Number of local meshes on the Y axis.
@@ -21,11 +129,11 @@ typedef struct comm_handler_s {
     /// Number of local meshes on the Z axis.
     u32 nb_z;
     /// X coordinate of local mesh inside the global one.
-    u32 coord_x;
+    usz coord_x;
     /// Y coordinate of local mesh inside the global one.
-    u32 coord_y;
-    /// Y coordinate of local mesh inside the global one.
-    u32 coord_z;
+    usz coord_y;
+    /// Z coordinate of local mesh inside the global one.
+    usz coord_z;
     /// X dimension of the local mesh.
     usz loc_dim_x;
     /// Y dimension of the local mesh.
@@ -44,10 +152,110 @@ typedef struct comm_handler_s {
     i32 id_back;
     /// Rank of the front neighboor process, -1 if none.
     i32 id_front;
+    /// Ghost cell exchanges of the meshes, set up on their first exchange.
+    usz nb_halos;
+    comm_halo_t halos[COMM_MAX_HALOS];
+    /// Ranks of the node and node rank of the neighbors in face order, -1 if absent or on another
+    /// node (shared-memory exchange only).
+    MPI_Comm node_comm;
+    i32 node_ids[COMM_NB_FACES];
+    /// Synchronization flags of the shared-memory exchange: the epoch (number of exchanges) whose
+    /// faces are ready to be copied, then the one whose ghost cells were copied, for the local rank
+    /// and of the neighbors on the node (in face order), in a window of the node.
+    MPI_Win flags_win;
+    u64* flags;
+    u64 const* peer_flags[COMM_NB_FACES];
+    u64 epoch;
+    /// Meshes allocated in shared-memory windows.
+    usz nb_windows;
+    comm_window_t windows[COMM_MAX_HALOS];
+    comm_progress_t progress;
 } comm_handler_t;
 
-comm_handler_t comm_handler_new(u32 rank, u32 comm_size, usz dim_x, usz dim_y, usz dim_z);
+/// Splits a `dim_x * dim_y * dim_z` mesh among the ranks of `comm`, collective over it.
+/// The split minimizes the total area of the faces between local meshes, each of them having at
+/// least `ghost` cells (the width of the ghost layers) along every axis. Along each axis, the
+/// slabs of ranks get shares of the cells proportional to the sum of their `weight`s (e.g. their
+/// throughput), remainders going to the slabs furthest below their share (the first ones with
+/// equal weights). Ranks may be reordered by the MPI implementation to match the topology of the
+/// machine: all exchanges go through the Cartesian communicator of the handler, with the
+/// `exchange` operations.
+comm_handler_t comm_handler_new(
+    MPI_Comm comm,
+    usz dim_x,
+    usz dim_y,
+    usz dim_z,
+    usz ghost,
+    f64 weight,
+    comm_exchange_t exchange
+);
+
+/// Splits the mesh like `comm_handler_new`, along the `nbs[0] * nbs[1] * nbs[2]` grid of ranks
+/// given instead of the one minimizing the halo surface (e.g. to keep the size of the local meshes
+/// when scaling the mesh with the number of ranks).
+comm_handler_t comm_handler_new_on_grid(
+    MPI_Comm comm,
+    i32 const nbs[static 3],
+    usz dim_x,
+    usz dim_y,
+    usz dim_z,
+    usz ghost,
+    f64 weight,
+    comm_exchange_t exchange
+);
 
 void comm_handler_print(comm_handler_t const* self);
 
-void comm_handler_ghost_exchange(comm_handler_t const* self, mesh_t* mesh);
+/// Returns whether the local mesh has at least one neighbor to exchange ghost cells with.
+bool comm_handler_has_neighbors(comm_handler_t const* self);
+
+/// Releases the communicators, the datatypes and the persistent requests of the exchanges.
+/// Meshes allocated by the handler must be dropped before.
+void comm_handler_drop(comm_handler_t* self);
+
+/// Starts the communication progress thread, pinned to `cpu` unless it is negative. MPI must
+/// have been initialized with `MPI_THREAD_MULTIPLE`. The thread is stopped by `comm_handler_drop`.
+void comm_handler_progress_start(comm_handler_t* self, i32 cpu);
+
+/// Allocates a mesh of `dim_x * dim_y * dim_z` core cells with `depth` times `order` deep ghost
+/// layers (see `mesh_new`), in a shared-memory window of the node
+/// with the shared-memory exchange (the allocation policy then only applies to the placement of
+/// pages by first touch), with `mesh_new` otherwise.
+/// Collective over the ranks of the node, which must allocate their meshes in the same order.
+mesh_t comm_handler_mesh_new(
+    comm_handler_t* self,
+    usz dim_x,
+    usz dim_y,
+    usz dim_z,
+    usz order,
+    usz depth,
+    mesh_kind_t kind,
+    mesh_alloc_t alloc
+);
+
+/// Releases a mesh allocated by `comm_handler_mesh_new`.
+void comm_handler_mesh_drop(comm_handler_t* self, mesh_t* mesh);
+
+/// Splits the mesh again with the new `weight` of the local rank (see `comm_handler_new`), over
+/// the same ranks and Cartesian communicator, collective over it.
+/// Returns a mesh of the new local dimensions (allocated with `mesh_new` and `alloc`) holding the
+/// core cells of `mesh`, which is laid out by the previous split. The exchanges set up so far are
+/// released: meshes of the previous split must then be dropped and allocated again.
+mesh_t comm_handler_rebalance(
+    comm_handler_t* self, f64 weight, mesh_t const* mesh, mesh_alloc_t alloc
+);
+
+/// Exchanges the ghost cells of `mesh` with the neighbors, from a single thread.
+/// The persistent requests of `mesh` are created on its first exchange and restarted afterwards.
+/// Deep ghost layers also receive the edges and corners of the ghost region, through the meshes of
+/// the face neighbors (their faces always go through MPI, even with the shared-memory exchange).
+void comm_handler_ghost_exchange(comm_handler_t* self, mesh_t* mesh);
+
+/// Starts the exchange of the ghost cells of `mesh`, from a single thread. The ghost layers must
+/// be as deep as the order of the stencil.
+/// The core cells sent must not be written, nor the ghost cells accessed, until the exchange is
+/// completed by `comm_handler_ghost_finish`.
+void comm_handler_ghost_start(comm_handler_t* self, mesh_t* mesh);
+
+/// Completes the exchange of the ghost cells of `mesh` started by `comm_handler_ghost_start`.
+void comm_handler_ghost_finish(comm_handler_t* self, mesh_t* mesh);
@@ -1,6 +1,14 @@
 #pragma once
 
 #include "../types.h"
+#include "comm_handler.h"
+#include "mesh.h"
+#include "snapshot.h"
+#include "solve.h"
+#include "team.h"
+
+/// Maximum length of a path in the configuration.
+#define CONFIG_PATH_LEN 256
 
 /// Problem configuration.
 typedef struct config_s {
@@ -8,11 +16,47 @@ typedef struct config_s {
     usz dim_y;
     usz dim_z;
     usz niter;
+    usz order;
+    mesh_alloc_t alloc;
+    solve_buffering_t buffering;
+    bool product;
+    kernel_isa_t simd;
+    usz time_block;
+    bool overlap;
+    comm_exchange_t exchange;
+    usz halo_depth;
+    comm_balance_t balance;
+    char weights[CONFIG_PATH_LEN];
+    usz rebalance;
+    usz metrics_batch;
+    usz snapshot;
+    char snapshot_path[CONFIG_PATH_LEN];
+    usz snapshot_step;
+    snapshot_region_t snapshot_region;
+    usz checkpoint;
+    char checkpoint_path[CONFIG_PATH_LEN];
+    bool restart;
+    char instrument[CONFIG_PATH_LEN];
+    bool perf;
+    char trace[CONFIG_PATH_LEN];
+    usz trace_events;
+    bool progress;
+    solve_sweep_t sweep;
+    solve_tile_t tile;
+    bool autotune;
+    char tune_cache[CONFIG_PATH_LEN];
+    usz threads;
+    team_affinity_t affinity;
 } config_t;
 
 /// Parse configuration from a file.
+/// The `STENCIL_SIMD` environment variable, if set, overrides the `simd` key.
 config_t config_parse_from_file(char const file_name[static 1]);
 
+/// Sets the configuration `key` to `val` (as they would appear in a `key=val` line of the
+/// configuration file). Returns false if either is invalid.
+bool config_set(config_t* self, char const key[static 1], char const val[static 1]);
+
 /// Retrieve size of x-axis from configuration.
 usz config_dim_x(config_t self);
 
@@ -25,5 +69,102 @@ usz config_dim_z(config_t self);
 /// Retrieve number of iterations from configuration.
 usz config_niter(config_t self);
 
+/// Retrieve order of the stencil from configuration.
+usz config_order(config_t self);
+
+/// Retrieve mesh allocation policy from configuration.
+mesh_alloc_t config_alloc(config_t self);
+
+/// Retrieve iteration buffering mode from configuration.
+solve_buffering_t config_buffering(config_t self);
+
+/// Retrieve whether the product A*B is precomputed once per iteration from configuration.
+bool config_product(config_t self);
+
+/// Retrieve requested stencil kernel variant from configuration.
+kernel_isa_t config_simd(config_t self);
+
+/// Retrieve number of iterations computed per temporally blocked sweep from configuration.
+usz config_time_block(config_t self);
+
+/// Retrieve whether ghost cell exchanges are overlapped with computations from configuration.
+bool config_overlap(config_t self);
+
+/// Retrieve MPI operations exchanging the ghost cells from configuration.
+comm_exchange_t config_exchange(config_t self);
+
+/// Retrieve number of iterations computed between two ghost cell exchanges from configuration.
+usz config_halo_depth(config_t self);
+
+/// Retrieve source of the weights of the ranks in the split of the mesh from configuration.
+comm_balance_t config_balance(config_t self);
+
+/// Retrieve path of the file of the weights of the ranks from configuration.
+char const* config_weights(config_t const* self);
+
+/// Retrieve number of iterations after which the mesh is split again according to the measured
+/// throughput of the ranks from configuration (0 to never split it again).
+usz config_rebalance(config_t self);
+
+/// Retrieve number of iterations whose metrics are aggregated at once from configuration (0 to
+/// aggregate them only at the end).
+usz config_metrics_batch(config_t self);
+
+/// Retrieve number of iterations between two snapshots of the mesh from configuration (0 to take
+/// none).
+usz config_snapshot(config_t self);
+
+/// Retrieve path of the snapshot file from configuration.
+char const* config_snapshot_path(config_t const* self);
+
+/// Retrieve distance between two cells of a snapshot along each axis from configuration.
+usz config_snapshot_step(config_t self);
+
+/// Retrieve region of the mesh written in the snapshots from configuration.
+snapshot_region_t config_snapshot_region(config_t self);
+
+/// Retrieve number of iterations between two checkpoints from configuration (0 to take none).
+usz config_checkpoint(config_t self);
+
+/// Retrieve prefix of the checkpoint files from configuration.
+char const* config_checkpoint_path(config_t const* self);
+
+/// Retrieve whether the run restarts from the checkpoint files from configuration.
+bool config_restart(config_t self);
+
+/// Retrieve path of the report of the instrumented phases from configuration (empty for none).
+char const* config_instrument(config_t const* self);
+
+/// Retrieve whether hardware events are counted to place the kernel on the roofline from
+/// configuration.
+bool config_perf(config_t self);
+
+/// Retrieve path of the trace of the phases from configuration (empty for none).
+char const* config_trace(config_t const* self);
+
+/// Retrieve number of events kept per thread by the trace from configuration.
+usz config_trace_events(config_t self);
+
+/// Retrieve whether a thread per rank is dedicated to communication progress from configuration.
+bool config_progress(config_t self);
+
+/// Retrieve loop nest used to sweep the mesh from configuration.
+solve_sweep_t config_sweep(config_t self);
+
+/// Retrieve tile shape of the blocked sweep from configuration.
+solve_tile_t config_tile(config_t self);
+
+/// Retrieve whether the tile shape and thread count are autotuned from configuration.
+bool config_autotune(config_t self);
+
+/// Retrieve path of the tuning cache from configuration.
+char const* config_tune_cache(config_t const* self);
+
+/// Retrieve number of threads per rank from configuration (0 to pick it automatically).
+usz config_threads(config_t self);
+
+/// Retrieve thread pinning policy from configuration.
+team_affinity_t config_affinity(config_t self);
+
 /// Prints a configuration.
 void config_print(config_t const* self);
@@ -2,5 +2,14 @@
 
 #include "mesh.h"
 #include "comm_handler.h"
+#include "solve.h"
 
-void init_meshes(mesh_t* A, mesh_t* B, mesh_t* C, comm_handler_t const* comm_handler);
+/// Initializes a single mesh, as `init_meshes` does (e.g. the ones not restored from a checkpoint).
+/// Must be called by all the threads of the parallel region that later runs the solver.
+void init_mesh(mesh_t* mesh, comm_handler_t const* comm_handler, solve_tile_t tile);
+
+/// Initializes the meshes, first-touching their core with the blocked sweep's `tile` shape.
+/// Must be called by all the threads of the parallel region that later runs the solver.
+void init_meshes(
+    mesh_t* A, mesh_t* B, mesh_t* C, comm_handler_t const* comm_handler, solve_tile_t tile
+);
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "../chrono.h"
+#include "../types.h"
+#include "perf.h"
+
+#include <mpi.h>
+
+/// Maximum number of threads per rank whose phases are timed, the others are ignored.
+#define INSTRUMENT_MAX_THREADS 256
+/// Default number of events kept per thread by the trace (see `instrument_trace_open`).
+#define INSTRUMENT_TRACE_EVENTS (1UL << 18)
+
+/// Phases of a run timed by the instrumentation.
+typedef enum instrument_phase_e {
+    /// Initialization of the meshes (`init_meshes`).
+    INSTRUMENT_PHASE_INIT,
+    /// Sweeps of the stencil (`solve_*`).
+    INSTRUMENT_PHASE_SOLVE,
+    /// Copies of the core of a mesh (`mesh_copy_core`).
+    INSTRUMENT_PHASE_COPY,
+    /// Ghost cell exchanges (`comm_handler_ghost_*`).
+    INSTRUMENT_PHASE_EXCHANGE,
+    /// Waits of the threads of the team at barriers.
+    INSTRUMENT_PHASE_BARRIER,
+    /// Outputs of the results: metrics, snapshots and checkpoints.
+    INSTRUMENT_PHASE_OUTPUT,
+    INSTRUMENT_NB_PHASES,
+} instrument_phase_t;
+
+/// Quantities counted by the instrumentation, per phase.
+typedef enum instrument_counter_e {
+    /// Bytes copied, sent or written.
+    INSTRUMENT_COUNTER_BYTES,
+    /// Faces sent to the neighbors (whether through MPI or shared memory).
+    INSTRUMENT_COUNTER_MESSAGES,
+    /// Cells computed or initialized.
+    INSTRUMENT_COUNTER_CELLS,
+    INSTRUMENT_NB_COUNTERS,
+} instrument_counter_t;
+
+/// Timer of a phase, stopped when it goes out of scope (see `INSTRUMENT_SCOPE`).
+typedef struct instrument_scope_s {
+    instrument_phase_t phase;
+    /// Name of the event in the trace, the instrumented function.
+    char const* name;
+    /// Whether the scope counts as a call of the phase (see `INSTRUMENT_SCOPE_PART`).
+    bool call;
+    chrono_t chrono;
+    /// Whether the hardware events of the thread are counted during the phase, and their counts
+    /// when it started.
+    bool counting;
+    u64 events[PERF_NB_EVENTS];
+} instrument_scope_t;
+
+/// Starts timing `phase` (traced as `name`) on the calling thread, counted as a call of it if
+/// `call` is set, and counting its hardware events if they are open and it is the solver or an
+/// exchange.
+instrument_scope_t instrument_scope_begin(
+    instrument_phase_t phase, char const name[static 1], bool call
+);
+
+/// Stops timing the phase of `scope` and adds its duration to the calling thread.
+void instrument_scope_end(instrument_scope_t* scope);
+
+/// Adds `n` to `counter` of `phase` on the calling thread.
+void instrument_count(instrument_phase_t phase, instrument_counter_t counter, u64 n);
+
+/// Records an instant event `name` with `value` in the trace of the calling thread, if it is open.
+void instrument_mark(char const name[static 1], u64 value);
+
+/// Span of a tile of a sweep in the trace, recorded when it goes out of scope (see
+/// `INSTRUMENT_TILE`).
+typedef struct instrument_tile_s {
+    /// Timepoint (in nanoseconds) of the beginning of the tile, 0 if the trace is not open.
+    u64 begin;
+} instrument_tile_t;
+
+/// Starts the span of a tile on the calling thread, only read from the clock if its trace is open.
+instrument_tile_t instrument_tile_begin(void);
+
+/// Records the span of `tile` as a `tile` event of the solver phase, if it was started in a trace.
+void instrument_tile_end(instrument_tile_t* tile);
+
+/// Instrumentation of the hot paths, compiled out unless `STENCIL_INSTRUMENT` is defined (see the
+/// `STENCIL_INSTRUMENT` CMake option). Threads are identified by their number in the enclosing
+/// OpenMP team, so they must only be used by its threads (or the main thread outside of it).
+#ifdef STENCIL_INSTRUMENT
+/// Times `phase` until the end of the enclosing block, at most once per block.
+#define INSTRUMENT_SCOPE(phase)                                                                    \
+    instrument_scope_t instrument_scope __attribute__((cleanup(instrument_scope_end))) =           \
+        instrument_scope_begin(phase, __func__, true)
+/// Times `phase` like `INSTRUMENT_SCOPE`, as a part of a call counted by another scope (e.g. the
+/// post of an exchange completed later).
+#define INSTRUMENT_SCOPE_PART(phase)                                                               \
+    instrument_scope_t instrument_scope __attribute__((cleanup(instrument_scope_end))) =           \
+        instrument_scope_begin(phase, __func__, false)
+/// Traces the tile computed until the end of the enclosing block, at most once per block.
+#define INSTRUMENT_TILE()                                                                          \
+    instrument_tile_t instrument_tile __attribute__((cleanup(instrument_tile_end))) =              \
+        instrument_tile_begin()
+#define INSTRUMENT_COUNT(phase, counter, n) instrument_count(phase, counter, n)
+#define INSTRUMENT_MARK(name, value) instrument_mark(name, value)
+#else
+#define INSTRUMENT_SCOPE(phase) ((void)0)
+#define INSTRUMENT_SCOPE_PART(phase) ((void)0)
+#define INSTRUMENT_TILE() ((void)0)
+#define INSTRUMENT_COUNT(phase, counter, n) ((void)(n))
+#define INSTRUMENT_MARK(name, value) ((void)(value))
+#endif
+
+/// Waits for the threads of the team at a barrier, timed as `INSTRUMENT_PHASE_BARRIER`.
+static inline void instrument_barrier(void) {
+    INSTRUMENT_SCOPE(INSTRUMENT_PHASE_BARRIER);
+    #pragma omp barrier
+}
+
+/// Writes the timings and counters of each phase to `path` from rank 0, as JSON if it ends with
+/// `.json`, CSV otherwise. Timings are reported across the threads of all ranks (minimum, mean,
+/// maximum and imbalance, the maximum over the mean minus one), and across the ranks (each taking
+/// as long as its slowest thread); counters are summed. Collective over `comm`.
+void instrument_report(MPI_Comm comm, char const path[static 1]);
+
+/// Opens the hardware events of the calling thread (see `perf_group_open`), counted from then on
+/// during the solver and exchange phases. Returns whether they are available.
+bool instrument_events_open(void);
+
+/// Clears the timings, counters and hardware event counts of all threads, e.g. to leave out the
+/// sweeps run while tuning. Open events stay open.
+void instrument_reset(void);
+
+/// Prints from rank 0 where the stencil kernel `name` sits on the roofline given by `ceilings` of
+/// each rank: achieved GFLOP/s (at `flops_per_cell` per cell update), bytes moved per cell update
+/// (measured from the memory or last level cache events, or their compulsory minimum without
+/// them) and arithmetic intensity, along with the instructions per cycle and cache misses of the
+/// solver and exchange phases. Closes the events of all threads. Collective over `comm`.
+void instrument_roofline(
+    MPI_Comm comm, char const name[static 1], usz flops_per_cell, perf_ceilings_t ceilings
+);
+
+/// Starts tracing the phases of the calling thread into a ring of the last `capacity` events,
+/// allocated (and touched) by the thread so that recording them never allocates. Phases are traced
+/// with the function they time, the tiles of the sweeps as `tile` and iterations with
+/// `INSTRUMENT_MARK`.
+void instrument_trace_open(usz capacity);
+
+/// Merges the traces of the threads of all ranks into `path` from rank 0, in the Chrome trace
+/// event format (loadable in Perfetto): one process per rank, one thread per thread of its team.
+/// Clocks of the ranks are aligned at a barrier. Closes the traces. Collective over `comm`.
+void instrument_trace_write(MPI_Comm comm, char const path[static 1]);
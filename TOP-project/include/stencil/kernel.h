@@ -0,0 +1,89 @@
+#pragma once
+
+#include "../types.h"
+#include "mesh.h"
+
+#include <assert.h>
+
+/// Instruction set targeted by a stencil kernel variant.
+typedef enum kernel_isa_e {
+    /// Widest variant supported by the running CPU.
+    KERNEL_ISA_AUTO,
+    KERNEL_ISA_SCALAR,
+    KERNEL_ISA_SSE2,
+    KERNEL_ISA_AVX2,
+    KERNEL_ISA_AVX512,
+} kernel_isa_t;
+
+/// Expands `X(order)` for each order of the stencil that has specialized kernel instances.
+#define KERNEL_FOR_EACH_ORDER(X) X(2) X(4) X(8)
+/// Number of orders in `KERNEL_FOR_EACH_ORDER`.
+#define KERNEL_NB_ORDERS 3
+
+/// Fully unrolls a loop over the orders of the stencil (at most `STENCIL_MAX_ORDER`).
+#define KERNEL_UNROLL_ORDERS _Pragma("GCC unroll 8")
+static_assert(STENCIL_MAX_ORDER <= 8, "`KERNEL_UNROLL_ORDERS` does not unroll all the orders");
+
+/// Divisors 17^o of each order `o` of the stencil, used by the scalar kernel which reproduces the
+/// reference results exactly.
+static f64 const KERNEL_POW17[STENCIL_MAX_ORDER + 1] = {
+    1.0, 17.0, 289.0, 4913.0, 83521.0, 1419857.0, 24137569.0, 410338673.0, 6975757441.0,
+};
+
+/// Reciprocals 1/17^o, used by the vectorized kernels.
+static f64 const KERNEL_INV17[STENCIL_MAX_ORDER + 1] = {
+    1.0,
+    1.0 / 17.0,
+    1.0 / 289.0,
+    1.0 / 4913.0,
+    1.0 / 83521.0,
+    1.0 / 1419857.0,
+    1.0 / 24137569.0,
+    1.0 / 410338673.0,
+    1.0 / 6975757441.0,
+};
+
+/// Computes `len` consecutive cells of C=B@A along the Z axis, starting at linear offset `q`.
+typedef void kernel_row_fn(
+    f64 const* restrict a, f64 const* restrict b, f64* restrict c, usz q, usz len, usz sx, usz sy
+);
+
+/// Computes `len` consecutive cells of C=B@A from the precomputed product P=A*B.
+typedef void kernel_product_row_fn(
+    f64 const* restrict p, f64* restrict c, usz q, usz len, usz sx, usz sy
+);
+
+/// Maximum number of X-axis planes a cell of C=B@A depends on (`2 * order + 1`).
+#define KERNEL_NB_PLANES (2 * STENCIL_MAX_ORDER + 1)
+
+/// Computes `len` consecutive cells of a row of C=B@A, starting at `c`, from the planes of the
+/// precomputed product P=A*B around it: `planes[o]` is the plane at X offset `o - order`,
+/// `q` is the offset of the first cell in the planes and `sy` the Y stride of the planes.
+typedef void kernel_ring_row_fn(
+    f64 const* const planes[static KERNEL_NB_PLANES], f64* restrict c, usz q, usz len, usz sy
+);
+
+/// Stencil kernel variant, specialized for an instruction set and an order of the stencil.
+typedef struct kernel_s {
+    kernel_isa_t isa;
+    char const* name;
+    usz order;
+    kernel_row_fn* row;
+    kernel_product_row_fn* product_row;
+    kernel_ring_row_fn* ring_row;
+} kernel_t;
+
+// Variants of each instruction set, one per order of `KERNEL_FOR_EACH_ORDER`
+extern kernel_t const KERNEL_SCALAR[KERNEL_NB_ORDERS];
+#if defined(__x86_64__)
+extern kernel_t const KERNEL_SSE2[KERNEL_NB_ORDERS];
+extern kernel_t const KERNEL_AVX2[KERNEL_NB_ORDERS];
+extern kernel_t const KERNEL_AVX512[KERNEL_NB_ORDERS];
+#endif
+
+/// Returns whether kernels are specialized for the given order of the stencil.
+bool kernel_has_order(usz order);
+
+/// Selects a kernel variant of the given order (see `kernel_has_order`). `KERNEL_ISA_AUTO` picks
+/// the widest one supported by the CPU, a variant that is not supported falls back to it.
+kernel_t const* kernel_select(kernel_isa_t isa, usz order);
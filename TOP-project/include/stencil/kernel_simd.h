@@ -0,0 +1,185 @@
+// Template of the vectorized stencil kernels, included once by each ISA-specific translation unit
+// (`kernel_sse2.c`, `kernel_avx2.c`, `kernel_avx512.c`) after defining:
+//  - `vec_t`, `VLEN`: vector type and its number of `f64` lanes;
+//  - `vload`, `vstore`, `vset1`, `vadd`, `vmul`, `vmadd(x, y, acc)`: vector operations;
+//  - `smadd(x, y, acc)`: scalar multiply-add, fused exactly when `vmadd` is;
+//  - `KERNEL_VAR`, `KERNEL_ISA`, `KERNEL_NAME`: exported variant, its ISA and name.
+// Rows are vectorized along the unit-stride Z axis, the remainder is computed one cell at a time
+// with the same operations as a lane, so that a cell does not depend on where its row is split.
+// The generic rows are instantiated for each order of `KERNEL_FOR_EACH_ORDER`, which unrolls
+// their loop over the orders and folds the coefficients into constants.
+
+#include "stencil/kernel.h"
+
+/// Computes a single cell of C=B@A, rounded like a lane of `simd_row`.
+static inline __attribute__((always_inline)) f64 simd_cell(
+    f64 const* restrict a, f64 const* restrict b, usz q, usz sx, usz sy, usz order
+) {
+    f64 sum = a[q] * b[q];
+    KERNEL_UNROLL_ORDERS
+    for (usz o = 1; o <= order; ++o) {
+        usz const ox = o * sx;
+        usz const oy = o * sy;
+        f64 t = a[q + ox] * b[q + ox];
+        t = smadd(a[q - ox], b[q - ox], t);
+        t = smadd(a[q + oy], b[q + oy], t);
+        t = smadd(a[q - oy], b[q - oy], t);
+        t = smadd(a[q + o], b[q + o], t);
+        t = smadd(a[q - o], b[q - o], t);
+        sum = smadd(t, KERNEL_INV17[o], sum);
+    }
+    return sum;
+}
+
+/// Computes a single cell of C=B@A from P=A*B, rounded like a lane of `simd_product_row`.
+static inline __attribute__((always_inline)) f64 simd_product_cell(
+    f64 const* restrict p, usz q, usz sx, usz sy, usz order
+) {
+    f64 sum = p[q];
+    KERNEL_UNROLL_ORDERS
+    for (usz o = 1; o <= order; ++o) {
+        f64 const t = p[q + o * sx] + p[q - o * sx] + p[q + o * sy] + p[q - o * sy] + p[q + o] +
+                      p[q - o];
+        sum = smadd(t, KERNEL_INV17[o], sum);
+    }
+    return sum;
+}
+
+/// Computes a single cell of C=B@A from product planes, rounded like a lane of `simd_ring_row`.
+static inline __attribute__((always_inline)) f64 simd_ring_cell(
+    f64 const* const planes[static KERNEL_NB_PLANES], usz q, usz sy, usz order
+) {
+    f64 const* p = planes[order];
+    f64 sum = p[q];
+    KERNEL_UNROLL_ORDERS
+    for (usz o = 1; o <= order; ++o) {
+        f64 const t = planes[order + o][q] + planes[order - o][q] + p[q + o * sy] +
+                      p[q - o * sy] + p[q + o] + p[q - o];
+        sum = smadd(t, KERNEL_INV17[o], sum);
+    }
+    return sum;
+}
+
+static inline __attribute__((always_inline)) void simd_row(
+    f64 const* restrict a,
+    f64 const* restrict b,
+    f64* restrict c,
+    usz q,
+    usz len,
+    usz sx,
+    usz sy,
+    usz order
+) {
+    usz k = 0;
+    for (; k + VLEN <= len; k += VLEN) {
+        f64 const* pa = a + q + k;
+        f64 const* pb = b + q + k;
+        vec_t sum = vmul(vload(pa), vload(pb));
+        KERNEL_UNROLL_ORDERS
+        for (usz o = 1; o <= order; ++o) {
+            usz const ox = o * sx;
+            usz const oy = o * sy;
+            vec_t t = vmul(vload(pa + ox), vload(pb + ox));
+            t = vmadd(vload(pa - ox), vload(pb - ox), t);
+            t = vmadd(vload(pa + oy), vload(pb + oy), t);
+            t = vmadd(vload(pa - oy), vload(pb - oy), t);
+            t = vmadd(vload(pa + o), vload(pb + o), t);
+            t = vmadd(vload(pa - o), vload(pb - o), t);
+            sum = vmadd(t, vset1(KERNEL_INV17[o]), sum);
+        }
+        vstore(c + q + k, sum);
+    }
+    for (; k < len; ++k) {
+        c[q + k] = simd_cell(a, b, q + k, sx, sy, order);
+    }
+}
+
+static inline __attribute__((always_inline)) void simd_product_row(
+    f64 const* restrict p, f64* restrict c, usz q, usz len, usz sx, usz sy, usz order
+) {
+    usz k = 0;
+    for (; k + VLEN <= len; k += VLEN) {
+        f64 const* pp = p + q + k;
+        vec_t sum = vload(pp);
+        KERNEL_UNROLL_ORDERS
+        for (usz o = 1; o <= order; ++o) {
+            usz const ox = o * sx;
+            usz const oy = o * sy;
+            vec_t t = vadd(vload(pp + ox), vload(pp - ox));
+            t = vadd(t, vload(pp + oy));
+            t = vadd(t, vload(pp - oy));
+            t = vadd(t, vload(pp + o));
+            t = vadd(t, vload(pp - o));
+            sum = vmadd(t, vset1(KERNEL_INV17[o]), sum);
+        }
+        vstore(c + q + k, sum);
+    }
+    for (; k < len; ++k) {
+        c[q + k] = simd_product_cell(p, q + k, sx, sy, order);
+    }
+}
+
+static inline __attribute__((always_inline)) void simd_ring_row(
+    f64 const* const planes[static KERNEL_NB_PLANES],
+    f64* restrict c,
+    usz q,
+    usz len,
+    usz sy,
+    usz order
+) {
+    f64 const* p = planes[order];
+    usz k = 0;
+    for (; k + VLEN <= len; k += VLEN) {
+        usz const r = q + k;
+        vec_t sum = vload(p + r);
+        KERNEL_UNROLL_ORDERS
+        for (usz o = 1; o <= order; ++o) {
+            usz const oy = o * sy;
+            vec_t t = vadd(vload(planes[order + o] + r), vload(planes[order - o] + r));
+            t = vadd(t, vload(p + r + oy));
+            t = vadd(t, vload(p + r - oy));
+            t = vadd(t, vload(p + r + o));
+            t = vadd(t, vload(p + r - o));
+            sum = vmadd(t, vset1(KERNEL_INV17[o]), sum);
+        }
+        vstore(c + k, sum);
+    }
+    for (; k < len; ++k) {
+        c[k] = simd_ring_cell(planes, q + k, sy, order);
+    }
+}
+
+#define SIMD_INSTANCE(N)                                                                           \
+    static void simd_row_##N(                                                                      \
+        f64 const* restrict a,                                                                     \
+        f64 const* restrict b,                                                                     \
+        f64* restrict c,                                                                           \
+        usz q,                                                                                     \
+        usz len,                                                                                   \
+        usz sx,                                                                                    \
+        usz sy                                                                                     \
+    ) {                                                                                            \
+        simd_row(a, b, c, q, len, sx, sy, N);                                                      \
+    }                                                                                              \
+    static void simd_product_row_##N(                                                              \
+        f64 const* restrict p, f64* restrict c, usz q, usz len, usz sx, usz sy                     \
+    ) {                                                                                            \
+        simd_product_row(p, c, q, len, sx, sy, N);                                                 \
+    }                                                                                              \
+    static void simd_ring_row_##N(                                                                 \
+        f64 const* const planes[static KERNEL_NB_PLANES], f64* restrict c, usz q, usz len, usz sy  \
+    ) {                                                                                            \
+        simd_ring_row(planes, c, q, len, sy, N);                                                   \
+    }
+KERNEL_FOR_EACH_ORDER(SIMD_INSTANCE)
+
+#define SIMD_KERNEL(N)                                                                             \
+    {                                                                                              \
+        .isa = KERNEL_ISA,                                                                         \
+        .name = KERNEL_NAME,                                                                       \
+        .order = N,                                                                                \
+        .row = simd_row_##N,                                                                       \
+        .product_row = simd_product_row_##N,                                                       \
+        .ring_row = simd_ring_row_##N,                                                             \
+    },
+kernel_t const KERNEL_VAR[KERNEL_NB_ORDERS] = {KERNEL_FOR_EACH_ORDER(SIMD_KERNEL)};
@@ -2,37 +2,81 @@
 
 #include "../types.h"
 
-#define STENCIL_ORDER 8UL
+/// Highest order of the stencil, the order of a run is picked at runtime (see `kernel_has_order`).
+#define STENCIL_MAX_ORDER 8UL
+
+/// Alignment (in bytes) of the mesh storage and of each of its Z-axis rows.
+#define MESH_ALIGNMENT 64UL
 
 typedef enum cell_kind_e {
     CELL_KIND_CORE,
     CELL_KIND_PHANTOM,
 } cell_kind_t;
 
-typedef struct cell_s {
-    f64 value;
-    cell_kind_t kind;
-} cell_t;
-
 typedef enum mesh_kind_e {
     MESH_KIND_CONSTANT,
     MESH_KIND_INPUT,
     MESH_KIND_OUTPUT,
+    MESH_KIND_PRODUCT,
 } mesh_kind_t;
 
+/// Kind of pages backing the storage of a mesh.
+typedef enum mesh_pages_e {
+    /// Regular base pages.
+    MESH_PAGES_DEFAULT,
+    /// Transparent huge pages, requested through `madvise(MADV_HUGEPAGE)`.
+    MESH_PAGES_TRANSPARENT,
+    /// Explicit huge pages through `MAP_HUGETLB`, falls back to transparent ones if none are free.
+    MESH_PAGES_HUGETLB,
+} mesh_pages_t;
+
+/// NUMA placement policy of the storage of a mesh.
+typedef enum mesh_numa_e {
+    /// Pages are placed on the node of the thread that first touches them.
+    MESH_NUMA_LOCAL,
+    /// Pages are interleaved round-robin across all allowed nodes.
+    MESH_NUMA_INTERLEAVE,
+} mesh_numa_t;
+
+/// Allocation policy of a mesh.
+typedef struct mesh_alloc_s {
+    mesh_pages_t pages;
+    mesh_numa_t numa;
+} mesh_alloc_t;
+
 /// Three-dimensional mesh.
-/// Storage of cells is in layout right (aka RowMajor).
+/// Storage of cells is in layout right (aka RowMajor) inside a single `MESH_ALIGNMENT`-aligned
+/// allocation. Rows along the Z axis are padded so that every row starts on an aligned boundary.
+/// The kind of a cell is not stored, it is deduced from its indices (see `mesh_set_cell_kind`).
+/// Pages are not touched by `mesh_new`, so that their placement is decided by the first writer.
 typedef struct mesh_s {
     usz dim_x;
     usz dim_y;
     usz dim_z;
-    cell_t*** cells;
+    /// Order of the stencil, the number of cells it reaches on each side along each axis.
+    usz order;
+    /// Width of the ghost layers on each side, a multiple of the order: ghost layers `depth` times
+    /// as wide as the order stay valid for `depth` iterations (see `solve_jacobi_extended`).
+    usz ghost;
+    /// Distance (in elements) between two consecutive cells on the X axis.
+    usz stride_x;
+    /// Distance (in elements) between two consecutive cells on the Y axis.
+    usz stride_y;
+    f64* values;
+    /// Size (in bytes) of the mapping holding the values.
+    usz size;
     mesh_kind_t kind;
 } mesh_t;
-#define __builtin_sync_proc(_) catof(p, l, e, a, s, e)(1)
 
-/// Initialize a mesh.
-mesh_t mesh_new(usz dim_x, usz dim_y, usz dim_z, mesh_kind_t kind);
+/// Returns the layout (dimensions, strides and size of the storage) of a mesh of
+/// `dim_x * dim_y * dim_z` core cells surrounded by `depth * order` ghost layers, without storage.
+mesh_t mesh_layout(usz dim_x, usz dim_y, usz dim_z, usz order, usz depth, mesh_kind_t kind);
+
+/// Initialize a mesh of `dim_x * dim_y * dim_z` core cells surrounded by `depth * order` ghost
+/// layers, for a stencil of order `order`.
+mesh_t mesh_new(
+    usz dim_x, usz dim_y, usz dim_z, usz order, usz depth, mesh_kind_t kind, mesh_alloc_t alloc
+);
 
 /// De-initialize a mesh.
 void mesh_drop(mesh_t* self);
@@ -44,16 +88,35 @@ void mesh_print(mesh_t const* self, char const* name);
 cell_kind_t mesh_set_cell_kind(mesh_t const* self, usz i, usz j, usz k);
 
 /// Copies the inner part of a mesh into another.
+/// Rows are shared among the threads of the enclosing parallel region, which must all call it.
 void mesh_copy_core(mesh_t* dst, mesh_t const* src);
 
+/// Rounds `n` up to a multiple of `m`, e.g. a size to the alignment or the pages of a mesh.
+static inline usz round_up(usz n, usz m) {
+    return (n + m - 1) / m * m;
+}
+
+/// Returns the linear offset of the indexed element (includes surrounding ghost cells).
+static inline usz mesh_offset(mesh_t const* self, usz i, usz j, usz k) {
+    return i * self->stride_x + j * self->stride_y + k;
+}
+
 /// Returns a pointer to the indexed element (includes surrounding ghost cells).
-f64* idx(mesh_t* self, usz i, usz j, usz k);
+static inline f64* idx(mesh_t* self, usz i, usz j, usz k) {
+    return self->values + mesh_offset(self, i, j, k);
+}
 
 /// Returns a pointer to the indexed element (ignores surrounding ghost cells).
-f64* idx_core(mesh_t* self, usz i, usz j, usz k);
+static inline f64* idx_core(mesh_t* self, usz i, usz j, usz k) {
+    return idx(self, i + self->ghost, j + self->ghost, k + self->ghost);
+}
 
 /// Returns the value at the indexed element (includes surrounding ghost cells).
-f64 idx_const(mesh_t const* self, usz i, usz j, usz k);
+static inline f64 idx_const(mesh_t const* self, usz i, usz j, usz k) {
+    return self->values[mesh_offset(self, i, j, k)];
+}
 
 /// Returns the value at the indexed element (ignores surrounding ghost cells).
-f64 idx_core_const(mesh_t const* self, usz i, usz j, usz k);
+static inline f64 idx_core_const(mesh_t const* self, usz i, usz j, usz k) {
+    return idx_const(self, i + self->ghost, j + self->ghost, k + self->ghost);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "../types.h"
+
+#include <mpi.h>
+#include <stdio.h>
+
+/// Timings and center values of the iterations.
+/// Every rank buffers its own timings, and the center value of the iterations whose center cell
+/// it computed. They are aggregated on rank 0 in batches: the reductions of a batch and the
+/// messages forwarding its center values are started once it is recorded, and completed (then
+/// written) when the next batch is, so that no global synchronization is added to the iterations.
+typedef struct metrics_s {
+    /// Private duplicate of the communicator of the ranks, and rank of the local one in it.
+    MPI_Comm comm;
+    i32 rank;
+    i32 comm_size;
+    /// Dimensions of the global mesh, written with every iteration.
+    usz dim_x;
+    usz dim_y;
+    usz dim_z;
+    /// Number of iterations, and number of iterations per batch (all of them if 0).
+    usz niter;
+    usz batch;
+    /// Elapsed and compute time of each iteration on the local rank (interleaved).
+    f64* times;
+    /// Sum, minimum and maximum over the ranks of `times` (rank 0 only).
+    f64* sums;
+    f64* mins;
+    f64* maxs;
+    /// Center value of each iteration, and whether the local rank computed it (on rank 0, the
+    /// values received from the ranks that computed them).
+    f64* centers;
+    bool* owns;
+    /// Message forwarding the center values of a batch computed by the local rank, and message
+    /// received by rank 0: the values, then whether they were computed by the sender (1 or 0).
+    f64* send_buf;
+    f64* recv_buf;
+    /// Number of iterations recorded, and first and last iterations of the batch in flight (equal
+    /// if none is).
+    usz nb_recorded;
+    usz flight_first;
+    usz flight_last;
+    /// Reductions of the batch in flight, and message forwarding its center values.
+    MPI_Request requests[4];
+    /// Output file of the center values and mean timings (rank 0 only).
+    FILE* ofp;
+} metrics_t;
+
+/// Creates the metrics of `niter` iterations of a `dim_x * dim_y * dim_z` mesh computed by the
+/// ranks of `comm`, aggregated every `batch` iterations (only once all are recorded if 0) and
+/// written to `ofp` by rank 0. Collective over `comm`.
+metrics_t metrics_new(
+    MPI_Comm comm, usz dim_x, usz dim_y, usz dim_z, usz niter, usz batch, FILE* ofp
+);
+
+/// Records the next iteration, which took `elapsed_s` seconds of which `compute_s` were spent
+/// computing (rather than exchanging ghost cells). `center` is the value of the center cell of the
+/// global mesh if the local rank `owns` it. Aggregates a batch when it is complete.
+void metrics_record(metrics_t* self, f64 elapsed_s, f64 compute_s, bool owns, f64 center);
+
+/// Aggregates the iterations recorded but not yet written, and prints a summary of the timings of
+/// the ranks (extremes, mean and load imbalance). Collective over the ranks.
+void metrics_finish(metrics_t* self);
+
+void metrics_drop(metrics_t* self);
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "../types.h"
+#include "mesh.h"
+#include "solve.h"
+
+#include <mpi.h>
+
+/// Size (in bytes) of a cache line, the unit of the memory traffic deduced from the events.
+#define PERF_CACHE_LINE 64
+
+/// Hardware events counted by `perf_event_open`.
+typedef enum perf_event_e {
+    PERF_EVENT_CYCLES,
+    PERF_EVENT_INSTRUCTIONS,
+    /// Misses of the last level cache.
+    PERF_EVENT_LLC_MISSES,
+    /// Reads and writes of the local memory node, not exposed by every CPU.
+    PERF_EVENT_MEMORY_READS,
+    PERF_EVENT_MEMORY_WRITES,
+    PERF_NB_EVENTS,
+} perf_event_t;
+
+/// Hardware events of a thread, counted together as a group led by the cycles.
+typedef struct perf_group_s {
+    /// Descriptor of the leader, -1 if the events are not available.
+    i32 leader;
+    /// Descriptors of the events, and their position in the values read from the group (-1 if the
+    /// event is not available).
+    i32 fds[PERF_NB_EVENTS];
+    i32 slots[PERF_NB_EVENTS];
+    i32 nb_slots;
+} perf_group_t;
+
+/// Ceilings of the roofline of a rank.
+typedef struct perf_ceilings_s {
+    /// Memory bandwidth (in bytes per second) of a STREAM triad run on all the ranks at once.
+    f64 bandwidth;
+    /// Floating-point throughput (in FLOP per second) of the stencil kernel on arrays held in the L2
+    /// of each thread.
+    f64 flops;
+} perf_ceilings_t;
+
+/// Opens the hardware events of the calling thread (user space only).
+/// Returns a group without leader if they are not available (e.g. denied by
+/// `perf_event_paranoid`), events missing on the CPU are left out of the group.
+perf_group_t perf_group_open(void);
+
+/// Reads the counts of the events of a group (0 for the missing ones).
+void perf_group_read(perf_group_t const* self, u64 values[static PERF_NB_EVENTS]);
+
+void perf_group_close(perf_group_t* self);
+
+/// Returns the nominal floating-point operations of a cell update of C=B@A of order `order`.
+static inline usz perf_flops_per_cell(usz order) {
+    // Center product, then per order six products, their sum, its scaling and accumulation
+    return 1 + 13 * order;
+}
+
+/// Measures the ceilings of the roofline of the local rank with `nb_threads` threads: the memory
+/// bandwidth of a STREAM triad, run at once on all the ranks of `comm` (so that ranks sharing a
+/// node share its bandwidth), and the throughput of the kernel of `solver` on arrays held in the
+/// L2 of each thread. Collective over `comm`.
+perf_ceilings_t perf_measure_ceilings(solver_t const* solver, usz nb_threads, MPI_Comm comm);
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "../types.h"
+#include "comm_handler.h"
+#include "mesh.h"
+
+#include <mpi.h>
+
+/// Identifies a snapshot file, followed by the version of its format.
+#define SNAPSHOT_MAGIC "TOPSNAP1"
+/// Size (in bytes) of the header of a snapshot file, the frames follow it.
+#define SNAPSHOT_HEADER_SIZE 128
+
+/// Number of snapshots written asynchronously while the next one is packed.
+#define SNAPSHOT_NB_BUFFERS 2
+
+/// Region of the global mesh written in the snapshots, cells `lo` to `hi` (excluded) along each
+/// axis. A `hi` of 0 extends the region to the end of the axis.
+typedef struct snapshot_region_s {
+    usz lo[3];
+    usz hi[3];
+} snapshot_region_t;
+
+/// Header of a snapshot file, all fields are 64-bit integers in the
+/// byte order of the machine (as are the values).
+/// Frames of `dims[0] * dims[1] * dims[2]` doubles (in row-major order, Z being contiguous)
+/// follow the header, then the `nb_frames` iterations after which they were taken.
+typedef struct snapshot_header_s {
+    char magic[8];
+    /// Dimensions of the global mesh.
+    u64 global_dims[3];
+    /// First cell of the region, and cells of a frame along each axis.
+    u64 origin[3];
+    u64 dims[3];
+    /// Distance between two cells of a frame along each axis (downsampling).
+    u64 step;
+    u64 nb_frames;
+    u64 reserved[4];
+} snapshot_header_t;
+
+/// Snapshots of the core of a mesh, written by all ranks into one global file with collective
+/// MPI-IO. Each rank writes its own block through a subarray file view. Snapshots are packed into
+/// one of `SNAPSHOT_NB_BUFFERS` buffers and written asynchronously, so that the iterations go on
+/// while the previous ones drain to disk.
+typedef struct snapshot_s {
+    MPI_File file;
+    snapshot_header_t header;
+    /// Frame cells of the local mesh: first cell (in the global mesh) and number along each axis,
+    /// and first cell in the frame.
+    usz first[3];
+    usz counts[3];
+    usz frame_starts[3];
+    /// Position of the local mesh in the global one (see `comm_handler_t`).
+    usz coords[3];
+    /// Buffers of the snapshots in flight and their writes.
+    f64* buffers[SNAPSHOT_NB_BUFFERS];
+    MPI_Request requests[SNAPSHOT_NB_BUFFERS];
+    /// Iterations of the frames written so far, and their capacity. Rank 0 writes them and the
+    /// header when the file is closed.
+    u64* iterations;
+    usz capacity;
+} snapshot_t;
+
+/// Parses a region given as `x0,y0,z0,x1,y1,z1` (or `all` for the whole mesh) into `out`.
+/// Returns false if `val` is invalid.
+bool snapshot_region_parse(char const val[static 1], snapshot_region_t* out);
+
+/// Creates the snapshot file at `path` of the cells of `region` taken every `step` cells along
+/// each axis, over the split of `comm_handler`. Collective over its ranks.
+snapshot_t snapshot_new(
+    comm_handler_t const* comm_handler,
+    char const path[static 1],
+    snapshot_region_t region,
+    usz step
+);
+
+/// Follows a new split of the mesh (see `comm_handler_rebalance`), once the snapshots in flight
+/// are written. Collective over the ranks.
+void snapshot_resplit(snapshot_t* self, comm_handler_t const* comm_handler);
+
+/// Starts writing the core of `mesh` (laid out by the current split) as the frame taken after
+/// `iteration`, from a single thread. Collective over the ranks.
+void snapshot_write(snapshot_t* self, mesh_t const* mesh, usz iteration);
+
+/// Completes the snapshots in flight, writes the header and the iterations of the frames and
+/// closes the file. Collective over the ranks.
+void snapshot_drop(snapshot_t* self);
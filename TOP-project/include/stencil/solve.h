@@ -1,5 +1,126 @@
 #pragma once
 
+#include "comm_handler.h"
+#include "kernel.h"
 #include "mesh.h"
 
-void solve_jacobi(mesh_t* A, mesh_t const* B, mesh_t* C);
+// The sweeps below (and `solve_commit`) share their work among the threads of the enclosing
+// parallel region: they must be called by all of them, with the same arguments. Called outside of
+// a parallel region, they run on the calling thread only.
+
+/// Shape (in cells) of the tiles of the blocked sweep.
+/// Tiles are statically distributed among threads so that `init_meshes` can first-touch each
+/// page from the thread that later computes it.
+typedef struct solve_tile_s {
+    usz x;
+    usz y;
+    /// Unit-stride axis, gets the longest block.
+    usz z;
+} solve_tile_t;
+
+// Tile shape used unless one is configured or picked by the autotuner (see `tune.h`). The best
+// one depends on the machine and on the mesh dimensions.
+#define SOLVE_TILE_DEFAULT ((solve_tile_t){.x = 4, .y = 32, .z = 256})
+
+/// How the output of an iteration becomes the input of the next one.
+typedef enum solve_buffering_e {
+    /// Swap the roles of the input and output meshes.
+    SOLVE_BUFFERING_SWAP,
+    /// Copy the core of the output mesh into the input one.
+    SOLVE_BUFFERING_COPY,
+} solve_buffering_t;
+
+// Tile shape of the temporally blocked sweep (see `solve_jacobi_temporal`). Tiles are skewed by
+// `order` cells per step along X and Y, so they must be at least twice as large.
+#define TIME_TILE_X 32
+#define TIME_TILE_Y 32
+
+// Tile shape of the streaming sweep (see `solve_jacobi_streaming`) in the Y/Z plane, small enough
+// for the ring of a thread to fit `STREAM_RING_BYTES` at any order: 204 KiB at order 8, 68 KiB at
+// order 4 and 31 KiB at order 2.
+#define STREAM_TILE_Y 16
+#define STREAM_TILE_Z 32
+/// Cache budget (in bytes) of the ring of product planes of a thread, the smallest L2 per core of
+/// current x86 CPUs.
+#define STREAM_RING_BYTES (256UL << 10)
+
+/// Loop nest used to sweep the mesh during an iteration.
+typedef enum solve_sweep_e {
+    /// 3D tiles statically distributed among threads.
+    SOLVE_SWEEP_BLOCKED,
+    /// 2.5D streaming along X with a ring of product planes (see `solve_jacobi_streaming`).
+    SOLVE_SWEEP_STREAMING,
+} solve_sweep_t;
+
+/// Cell whose value is recorded after every step of a multi-step sweep.
+typedef struct solve_probe_s {
+    /// Whether the cell belongs to the local mesh.
+    bool active;
+    /// Indices of the cell (includes surrounding ghost cells).
+    usz i;
+    usz j;
+    usz k;
+    /// Value of the cell after each step.
+    f64* values;
+} solve_probe_t;
+
+/// Stencil solver, holds the kernel variant selected for the running CPU and the order of the
+/// stencil, and the tile shape of the blocked sweep. Meshes must have at least as many ghost
+/// layers as the order of the kernel, the streaming and temporal sweeps exactly as many.
+typedef struct solver_s {
+    kernel_t const* kernel;
+    solve_tile_t tile;
+} solver_t;
+
+/// Initialize a solver with the requested kernel variant (see `kernel_select`) and tile shape.
+solver_t solver_new(kernel_isa_t isa, usz order, solve_tile_t tile);
+
+/// Computes one Jacobi iteration C=B@A (only the core of `C` is written).
+void solve_jacobi(solver_t const* self, mesh_t const* A, mesh_t const* B, mesh_t* C);
+
+/// Computes one Jacobi iteration C=B@A on the core of `C` extended by `extents[n]` ghost cells
+/// toward face `n` (left, right, top, bottom, front then back), which are valid in `A` up to
+/// `extents[n] + order` cells.
+/// With ghost layers `s` times as deep as the order, `s` iterations are computed between two
+/// exchanges: the extents shrink by `order` at every iteration and are 0 on the last one.
+void solve_jacobi_extended(
+    solver_t const* self, mesh_t const* A, mesh_t const* B, mesh_t* C, usz const extents[static 6]
+);
+
+/// Computes the pointwise product P=A*B on the core and on the ghost cells read by the stencil.
+void solve_product(solver_t const* self, mesh_t const* A, mesh_t const* B, mesh_t* P);
+
+/// Computes one Jacobi iteration C=B@A from the precomputed product P=A*B.
+void solve_jacobi_product(solver_t const* self, mesh_t const* P, mesh_t* C);
+
+/// Computes one Jacobi iteration C=B@A overlapped with the exchange of the ghost cells of `C`.
+/// The shell of the core as deep as the ghost layers, sent to the neighbors, is computed first. The
+/// master thread then starts its exchange and the interior is computed while messages are in
+/// flight. The exchange must be completed with `comm_handler_ghost_finish` before `C` is read.
+/// If `P` is not NULL, the product A*B is precomputed in it (see `solve_jacobi_product`).
+void solve_jacobi_overlap(
+    solver_t const* self,
+    mesh_t const* A,
+    mesh_t const* B,
+    mesh_t* C,
+    mesh_t* P,
+    comm_handler_t* comm_handler
+);
+
+/// Computes one Jacobi iteration C=B@A by streaming along the X axis.
+/// Threads split the Y/Z plane into tiles. Each thread keeps a ring of the `2 * order + 1`
+/// planes of the product A*B around the current X position. Every new plane is loaded (and
+/// multiplied) once, then reused for all the taps along X.
+void solve_jacobi_streaming(solver_t const* self, mesh_t const* A, mesh_t const* B, mesh_t* C);
+
+/// Computes `steps` Jacobi iterations with temporal blocking: tiles skewed in time along X and Y
+/// are advanced through all the steps while they are still in cache.
+/// The ghost cells of `A` and `C` must stay valid during the whole sweep (i.e. the mesh has no
+/// neighbor to exchange them with). Meshes are used as double buffers, the result of the last step
+/// is in `C` if `steps` is odd and in `A` otherwise.
+void solve_jacobi_temporal(
+    solver_t const* self, mesh_t* A, mesh_t const* B, mesh_t* C, usz steps, solve_probe_t* probe
+);
+
+/// Makes the output `C` of the last iteration the current input `A`.
+void solve_commit(mesh_t** A, mesh_t** C, solve_buffering_t buffering);
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "../types.h"
+
+#include <mpi.h>
+
+/// Pinning of the threads of a team to the CPUs of their rank.
+typedef enum team_affinity_e {
+    /// Threads are left to the scheduler.
+    TEAM_AFFINITY_NONE,
+    /// Thread `t` is pinned to the `t`-th CPU of the rank.
+    TEAM_AFFINITY_COMPACT,
+    /// Threads are pinned to CPUs evenly spread over those of the rank.
+    TEAM_AFFINITY_SPREAD,
+} team_affinity_t;
+
+/// OpenMP thread team of a rank and the CPUs it runs on.
+typedef struct team_s {
+    /// Number of threads of the team.
+    usz nb_threads;
+    team_affinity_t affinity;
+    /// CPUs of the rank the team runs on, in increasing order.
+    usz nb_cpus;
+    i32* cpus;
+    /// CPU the communication progress thread is pinned to, -1 if there is none or it is not
+    /// pinned.
+    i32 progress_cpu;
+    /// Rank among the ranks sharing the node, and their number.
+    i32 node_rank;
+    i32 node_size;
+} team_t;
+
+/// Builds the thread team of the calling rank, collective over `comm`.
+/// The CPUs the ranks of a node are allowed to run on are divided evenly among the ranks sharing
+/// them (all the ranks of the node if the launcher did not bind them). With `progress`, the last
+/// of them is reserved to the communication progress thread (see `comm_handler_progress_start`).
+/// `nb_threads` is the number of threads of the team, 0 picks `OMP_NUM_THREADS` if set and one
+/// thread per CPU otherwise.
+team_t team_new(usz nb_threads, team_affinity_t affinity, bool progress, MPI_Comm comm);
+
+/// Releases the resources of a team.
+void team_drop(team_t* self);
+
+/// Pins the calling thread to its CPU, must be called by every thread of the parallel region.
+void team_pin(team_t const* self);
+
+/// Waits for all the ranks of `comm`, sleeping (for up to a millisecond at a time) rather than
+/// polling, so that waiting ranks leave their CPUs to the threads of the ranks still working.
+void team_idle_barrier(MPI_Comm comm);
+
+/// Prints a team.
+void team_print(team_t const* self, i32 rank);
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "../types.h"
+#include "mesh.h"
+#include "solve.h"
+
+/// Maximum length of the CPU model name in a tuning key.
+#define TUNE_CPU_MODEL_LEN 64
+
+/// Identifies a tuning problem: the same key on a later run reuses the cached parameters.
+typedef struct tune_key_s {
+    /// CPU model, as reported by `/proc/cpuinfo`.
+    char cpu_model[TUNE_CPU_MODEL_LEN];
+    /// Name and order of the stencil kernel variant.
+    char const* kernel;
+    usz order;
+    /// Loop nest used to sweep the mesh.
+    solve_sweep_t sweep;
+    /// Whether the product A*B is precomputed once per iteration.
+    bool product;
+    /// Local mesh dimensions (excludes surrounding ghost cells).
+    usz dim_x;
+    usz dim_y;
+    usz dim_z;
+    /// Number of available threads.
+    usz nb_threads;
+} tune_key_t;
+
+/// Parameters picked by the autotuner.
+typedef struct tune_params_s {
+    solve_tile_t tile;
+    usz nb_threads;
+} tune_params_t;
+
+/// Builds the tuning key of a local mesh of `dim_x * dim_y * dim_z` cells computed by `solver`
+/// with at most `nb_threads` threads.
+tune_key_t tune_key_new(
+    solver_t const* solver,
+    solve_sweep_t sweep,
+    bool product,
+    usz dim_x,
+    usz dim_y,
+    usz dim_z,
+    usz nb_threads
+);
+
+/// Looks up the parameters of `key` in the tuning cache at `path`.
+/// Returns false if the cache has no entry for it (the last entry wins if there are several).
+bool tune_cache_lookup(char const path[static 1], tune_key_t const* key, tune_params_t* params);
+
+/// Appends the parameters of `key` to the tuning cache at `path`.
+void tune_cache_store(char const path[static 1], tune_key_t const* key, tune_params_t const* params);
+
+/// Searches the tile shape and thread count that minimize the time of an iteration of `key`.
+/// The search is a coordinate descent (thread count, then tile along Z, Y and X) timed on scratch
+/// meshes of the local dimensions, allocated with `alloc` and dropped before returning.
+tune_params_t tune_search(solver_t const* solver, tune_key_t const* key, mesh_alloc_t alloc);
+
+/// Picks the parameters of `key` on every rank of `comm`, collective over it. Ranks with the same
+/// key share its parameters: the lowest of them looks them up in the tuning cache at `path`, or
+/// searches them (always if `force` is set) and stores them, then sends them to the others. The
+/// searches of a node run one after the other so that they do not compete for its CPUs, while the
+/// other ranks of the node sleep.
+tune_params_t tune_shared(
+    MPI_Comm comm,
+    solver_t const* solver,
+    tune_key_t const* key,
+    char const path[static 1],
+    mesh_alloc_t alloc,
+    bool force
+);
+
+/// Returns the throughput (in cells per second) of `solver` with `nb_threads` threads, timed on
+/// scratch meshes of a fixed size allocated with `alloc`. Used to weight the split of the mesh
+/// among ranks of different speeds.
+f64 tune_calibrate(solver_t const* solver, usz nb_threads, mesh_alloc_t alloc);
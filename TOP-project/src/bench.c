@@ -0,0 +1,515 @@
+#define _GNU_SOURCE
+
+#include "chrono.h"
+#include "logging.h"
+#include "stencil/comm_handler.h"
+#include "stencil/config.h"
+#include "stencil/init.h"
+#include "stencil/mesh.h"
+#include "stencil/solve.h"
+#include "stencil/team.h"
+
+#include <math.h>
+#include <mpi.h>
+#include <omp.h>
+#include <stdio.h>
+#include <string.h>
+
+static char* DEFAULT_CONFIG_PATH = "../config.txt";
+static char* DEFAULT_OUTPUT_PATH = NULL;
+
+/// Maximum number of values of a swept parameter.
+#define BENCH_MAX_VALUES 64
+
+/// How the mesh dimensions of a configuration relate to its number of ranks.
+typedef enum bench_scaling_e {
+    /// Dimensions are those of the global mesh, split among the ranks.
+    BENCH_SCALING_STRONG,
+    /// Dimensions are those of the mesh of each rank, the global mesh grows with the ranks.
+    BENCH_SCALING_WEAK,
+} bench_scaling_t;
+
+/// Parameters swept by the benchmark, every combination of their values is run.
+typedef enum bench_axis_e {
+    /// Mesh dimensions, `N` or `XxYxZ`.
+    BENCH_AXIS_SIZES,
+    /// Number of ranks, the first ones of `MPI_COMM_WORLD`.
+    BENCH_AXIS_RANKS,
+    /// Threads per rank, kernel variants and tile shapes (`XxYxZ`), as in the configuration.
+    BENCH_AXIS_THREADS,
+    BENCH_AXIS_SIMD,
+    BENCH_AXIS_TILES,
+    BENCH_NB_AXES,
+} bench_axis_t;
+
+static char const* AXIS_KEYS[BENCH_NB_AXES] = {"sizes", "ranks", "threads", "simd", "tiles"};
+
+/// Values of the swept parameters, split from comma-separated lists. An axis without value keeps
+/// the one of the configuration.
+typedef struct bench_sweep_s {
+    char* lists[BENCH_NB_AXES];
+    usz nb_values[BENCH_NB_AXES];
+    char const* values[BENCH_NB_AXES][BENCH_MAX_VALUES];
+    bench_scaling_t scaling;
+    /// Iterations run before the timed ones, discarded.
+    usz warmup;
+    /// Timed iterations of every configuration.
+    usz repeat;
+} bench_sweep_t;
+
+/// Statistics of the iteration time (in seconds) of a configuration, an iteration taking as long
+/// as on its slowest rank.
+typedef struct bench_stats_s {
+    f64 min;
+    f64 median;
+    f64 mean;
+    /// Distribution-free 95% confidence interval of the median.
+    f64 ci_lo;
+    f64 ci_hi;
+} bench_stats_t;
+
+/// Splits the comma-separated `list` into the values of `axis`.
+static void sweep_set(bench_sweep_t* self, bench_axis_t axis, char const list[static 1]) {
+    free(self->lists[axis]);
+    self->lists[axis] = strdup(list);
+    self->nb_values[axis] = 0;
+    char* saveptr = NULL;
+    for (char* v = strtok_r(self->lists[axis], ",", &saveptr); NULL != v;
+         v = strtok_r(NULL, ",", &saveptr))
+    {
+        if (BENCH_MAX_VALUES == self->nb_values[axis]) {
+            error("more than %d values for `%s`", BENCH_MAX_VALUES, AXIS_KEYS[axis]);
+        }
+        self->values[axis][self->nb_values[axis]++] = v;
+    }
+}
+
+/// Applies an option of the benchmark. Returns false if `key` is not one.
+static bool sweep_option(bench_sweep_t* self, char const key[static 1], char const val[static 1]) {
+    for (usz a = 0; a < BENCH_NB_AXES; ++a) {
+        if (0 == strcmp(AXIS_KEYS[a], key)) {
+            sweep_set(self, (bench_axis_t)a, val);
+            return true;
+        }
+    }
+    if (0 == strcmp("scaling", key)) {
+        if (0 == strcmp("strong", val)) {
+            self->scaling = BENCH_SCALING_STRONG;
+        } else if (0 == strcmp("weak", val)) {
+            self->scaling = BENCH_SCALING_WEAK;
+        } else {
+            error("invalid scaling `%s`, expected `strong` or `weak`", val);
+        }
+    } else if (0 == strcmp("warmup", key)) {
+        if (1 != sscanf(val, "%zu", &self->warmup)) {
+            error("invalid number of warm-up iterations `%s`", val);
+        }
+    } else if (0 == strcmp("repeat", key)) {
+        if (1 != sscanf(val, "%zu", &self->repeat) || 0 == self->repeat) {
+            error("invalid number of timed iterations `%s`", val);
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/// Parses `XxYxZ`, or `N` for `NxNxN`.
+static bool parse_shape(char const val[static 1], usz shape[static 3]) {
+    char end;
+    if (3 == sscanf(val, "%zux%zux%zu%c", &shape[0], &shape[1], &shape[2], &end)) {
+        return shape[0] > 0 && shape[1] > 0 && shape[2] > 0;
+    }
+    if (1 == sscanf(val, "%zu%c", &shape[0], &end)) {
+        shape[1] = shape[0];
+        shape[2] = shape[0];
+        return shape[0] > 0;
+    }
+    return false;
+}
+
+/// Applies `val` of `axis` to `cfg` (or to `nb_ranks`).
+static bool axis_apply(bench_axis_t axis, char const val[static 1], config_t* cfg, i32* nb_ranks) {
+    usz shape[3];
+    switch (axis) {
+        case BENCH_AXIS_SIZES:
+            if (!parse_shape(val, shape)) {
+                return false;
+            }
+            cfg->dim_x = shape[0];
+            cfg->dim_y = shape[1];
+            cfg->dim_z = shape[2];
+            return true;
+        case BENCH_AXIS_RANKS:
+            return 1 == sscanf(val, "%d", nb_ranks) && *nb_ranks > 0;
+        case BENCH_AXIS_THREADS:
+            return config_set(cfg, "threads", val);
+        case BENCH_AXIS_SIMD:
+            return config_set(cfg, "simd", val);
+        case BENCH_AXIS_TILES:
+            if (!parse_shape(val, shape)) {
+                return false;
+            }
+            cfg->tile = (solve_tile_t){.x = shape[0], .y = shape[1], .z = shape[2]};
+            return true;
+        default:
+            __builtin_unreachable();
+    }
+}
+
+/// Orders floating-point numbers for `qsort`.
+static int compare_f64(void const* a, void const* b) {
+    f64 const x = *(f64 const*)a;
+    f64 const y = *(f64 const*)b;
+    return (x > y) - (x < y);
+}
+
+/// Sorts `times` and returns their statistics.
+static bench_stats_t stats_of(f64* times, usz n) {
+    qsort(times, n, sizeof(f64), compare_f64);
+    f64 sum = 0.0;
+    for (usz i = 0; i < n; ++i) {
+        sum += times[i];
+    }
+    // Order statistics bounding the median with 95% confidence (normal approximation of the
+    // binomial distribution of the number of times below it)
+    f64 const half_width = 1.96 * sqrt((f64)n) / 2.0;
+    f64 const lo = floor((f64)n / 2.0 - half_width);
+    f64 const hi = ceil((f64)n / 2.0 + half_width);
+    return (bench_stats_t){
+        .min = times[0],
+        .median = (0 == n % 2) ? (times[n / 2 - 1] + times[n / 2]) / 2.0 : times[n / 2],
+        .mean = sum / (f64)n,
+        .ci_lo = times[(lo < 1.0) ? 0 : (usz)lo - 1],
+        .ci_hi = times[(hi > (f64)n) ? n - 1 : (usz)hi - 1],
+    };
+}
+
+/// Runs a configuration on the first `nb_ranks` ranks of `MPI_COMM_WORLD`, and writes its
+/// statistics to `ofp` from rank 0. Collective over `MPI_COMM_WORLD`.
+static void bench_run(
+    config_t const* cfg, i32 nb_ranks, bench_sweep_t const* sweep, FILE* ofp
+) {
+    i32 world_rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+    MPI_Comm comm;
+    MPI_Comm_split(
+        MPI_COMM_WORLD, (world_rank < nb_ranks) ? 0 : MPI_UNDEFINED, world_rank, &comm
+    );
+    if (MPI_COMM_NULL == comm) {
+        team_idle_barrier(MPI_COMM_WORLD);
+        return;
+    }
+    i32 rank;
+    MPI_Comm_rank(comm, &rank);
+
+    // Weak scaling grows the mesh of a rank along the axes of a balanced grid of ranks, which the
+    // mesh is split along so that every rank keeps the configured size
+    usz dims[3] = {cfg->dim_x, cfg->dim_y, cfg->dim_z};
+    team_t team = team_new(cfg->threads, cfg->affinity, false, comm);
+    solver_t solver = solver_new(cfg->simd, cfg->order, cfg->tile);
+    comm_handler_t comm_handler;
+    if (BENCH_SCALING_WEAK == sweep->scaling) {
+        i32 grid[3] = {0, 0, 0};
+        MPI_Dims_create(nb_ranks, 3, grid);
+        for (usz a = 0; a < 3; ++a) {
+            dims[a] *= (usz)grid[a];
+        }
+        comm_handler = comm_handler_new_on_grid(
+            comm, grid, dims[0], dims[1], dims[2], cfg->order, 1.0, cfg->exchange
+        );
+    } else {
+        comm_handler = comm_handler_new(
+            comm, dims[0], dims[1], dims[2], cfg->order, 1.0, cfg->exchange
+        );
+    }
+    usz const loc_dims[3] = {
+        comm_handler.loc_dim_x,
+        comm_handler.loc_dim_y,
+        comm_handler.loc_dim_z,
+    };
+    if (BENCH_SCALING_WEAK == sweep->scaling &&
+        (loc_dims[0] != cfg->dim_x || loc_dims[1] != cfg->dim_y || loc_dims[2] != cfg->dim_z)) {
+        error(
+            "rank %d got %zux%zux%zu cells instead of %zux%zux%zu in weak scaling",
+            rank,
+            loc_dims[0],
+            loc_dims[1],
+            loc_dims[2],
+            cfg->dim_x,
+            cfg->dim_y,
+            cfg->dim_z
+        );
+    }
+    mesh_t A = comm_handler_mesh_new(
+        &comm_handler,
+        loc_dims[0],
+        loc_dims[1],
+        loc_dims[2],
+        cfg->order,
+        1,
+        MESH_KIND_INPUT,
+        cfg->alloc
+    );
+    mesh_t B = comm_handler_mesh_new(
+        &comm_handler,
+        loc_dims[0],
+        loc_dims[1],
+        loc_dims[2],
+        cfg->order,
+        1,
+        MESH_KIND_CONSTANT,
+        cfg->alloc
+    );
+    mesh_t C = comm_handler_mesh_new(
+        &comm_handler,
+        loc_dims[0],
+        loc_dims[1],
+        loc_dims[2],
+        cfg->order,
+        1,
+        MESH_KIND_OUTPUT,
+        cfg->alloc
+    );
+    bool const product = cfg->product && SOLVE_SWEEP_BLOCKED == cfg->sweep;
+    mesh_t P = {0};
+    if (product) {
+        P = mesh_new(
+            loc_dims[0], loc_dims[1], loc_dims[2], cfg->order, 1, MESH_KIND_PRODUCT, cfg->alloc
+        );
+    }
+    bool const overlap = cfg->overlap && SOLVE_BUFFERING_SWAP == cfg->buffering &&
+                         SOLVE_SWEEP_BLOCKED == cfg->sweep &&
+                         comm_handler_has_neighbors(&comm_handler);
+
+    // Every iteration starts from a barrier of the ranks, its time is the one of the slowest
+    usz const nb_iters = sweep->warmup + sweep->repeat;
+    f64* times = malloc(sweep->repeat * sizeof(f64));
+    chrono_t chrono;
+
+    #pragma omp parallel num_threads(team.nb_threads)
+    {
+        team_pin(&team);
+        init_meshes(&A, &B, &C, &comm_handler, solver.tile);
+        #pragma omp master
+        {
+            comm_handler_ghost_exchange(&comm_handler, &A);
+            comm_handler_ghost_exchange(&comm_handler, &B);
+            comm_handler_ghost_exchange(&comm_handler, &C);
+        }
+        #pragma omp barrier
+
+        mesh_t* curr = &A;
+        mesh_t* next = &C;
+        for (usz it = 0; it < nb_iters; ++it) {
+            #pragma omp master
+            {
+                MPI_Barrier(comm);
+                chrono_start(&chrono);
+            }
+            #pragma omp barrier
+
+            if (overlap) {
+                solve_jacobi_overlap(&solver, curr, &B, next, product ? &P : NULL, &comm_handler);
+            } else if (SOLVE_SWEEP_STREAMING == cfg->sweep) {
+                solve_jacobi_streaming(&solver, curr, &B, next);
+            } else if (product) {
+                solve_product(&solver, curr, &B, &P);
+                solve_jacobi_product(&solver, &P, next);
+            } else {
+                solve_jacobi(&solver, curr, &B, next);
+            }
+            solve_commit(&curr, &next, cfg->buffering);
+
+            #pragma omp master
+            {
+                if (overlap) {
+                    comm_handler_ghost_finish(&comm_handler, curr);
+                } else {
+                    comm_handler_ghost_exchange(&comm_handler, curr);
+                }
+                chrono_stop(&chrono);
+                if (it >= sweep->warmup) {
+                    times[it - sweep->warmup] = duration_as_s_f64(chrono_elapsed(chrono));
+                }
+            }
+            #pragma omp barrier
+        }
+    }
+
+    i32 const count = (i32)sweep->repeat;
+    MPI_Allreduce(MPI_IN_PLACE, times, count, MPI_DOUBLE, MPI_MAX, comm);
+    if (0 == rank) {
+        bench_stats_t const stats = stats_of(times, sweep->repeat);
+        f64 const nb_cells = (f64)dims[0] * (f64)dims[1] * (f64)dims[2];
+        fprintf(
+            ofp,
+            "%s,%d,%u,%u,%u,%zu,%s,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,"
+            "%.9lf,%.9lf,%.9lf,%.9lf,%.9lf,%.6le\n",
+            (BENCH_SCALING_WEAK == sweep->scaling) ? "weak" : "strong",
+            nb_ranks,
+            comm_handler.nb_x,
+            comm_handler.nb_y,
+            comm_handler.nb_z,
+            team.nb_threads,
+            solver.kernel->name,
+            cfg->order,
+            solver.tile.x,
+            solver.tile.y,
+            solver.tile.z,
+            dims[0],
+            dims[1],
+            dims[2],
+            loc_dims[0],
+            loc_dims[1],
+            loc_dims[2],
+            sweep->warmup,
+            sweep->repeat,
+            stats.min,
+            stats.median,
+            stats.mean,
+            stats.ci_lo,
+            stats.ci_hi,
+            nb_cells / stats.median
+        );
+        fflush(ofp);
+        info(
+            "%d ranks x %zu threads, `%s`, tile %zux%zux%zu, %zux%zux%zu cells: median %.6lf s",
+            nb_ranks,
+            team.nb_threads,
+            solver.kernel->name,
+            solver.tile.x,
+            solver.tile.y,
+            solver.tile.z,
+            dims[0],
+            dims[1],
+            dims[2],
+            stats.median
+        );
+    }
+
+    free(times);
+    comm_handler_mesh_drop(&comm_handler, &A);
+    comm_handler_mesh_drop(&comm_handler, &B);
+    comm_handler_mesh_drop(&comm_handler, &C);
+    mesh_drop(&P);
+    comm_handler_drop(&comm_handler);
+    team_drop(&team);
+    MPI_Comm_free(&comm);
+    team_idle_barrier(MPI_COMM_WORLD);
+}
+
+i32 main(i32 argc, char* argv[argc + 1]) {
+    // Positional arguments are the configuration and output paths, `--key=value` options are
+    // either the swept parameters and options of the benchmark, or override the configuration
+    char* config_path = DEFAULT_CONFIG_PATH;
+    char* output_path = DEFAULT_OUTPUT_PATH;
+    usz nb_positional = 0;
+    for (i32 a = 1; a < argc; ++a) {
+        if (0 == strncmp("--", argv[a], 2)) {
+            continue;
+        } else if (0 == nb_positional) {
+            config_path = argv[a];
+            nb_positional += 1;
+        } else if (1 == nb_positional) {
+            output_path = argv[a];
+            nb_positional += 1;
+        } else {
+            error("unexpected argument `%s`", argv[a]);
+        }
+    }
+    config_t cfg = config_parse_from_file(config_path);
+    bench_sweep_t sweep = {.scaling = BENCH_SCALING_STRONG, .warmup = 2, .repeat = 10};
+    for (i32 a = 1; a < argc; ++a) {
+        if (0 != strncmp("--", argv[a], 2)) {
+            continue;
+        }
+        char key[32];
+        char val[CONFIG_PATH_LEN];
+        if (2 != sscanf(argv[a] + 2, "%31[^=]=%255s", key, val) ||
+            !(sweep_option(&sweep, key, val) || config_set(&cfg, key, val)))
+        {
+            error("invalid option `%s`, expected `--key=value`", argv[a]);
+        }
+    }
+
+    i32 provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    i32 rank;
+    i32 size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    // Every value is checked before the first run, swept rank counts beyond the available ones are
+    // left out
+    for (usz a = 0; a < BENCH_NB_AXES; ++a) {
+        for (usz v = 0; v < sweep.nb_values[a]; ++v) {
+            config_t scratch = cfg;
+            i32 nb_ranks;
+            if (!axis_apply((bench_axis_t)a, sweep.values[a][v], &scratch, &nb_ranks)) {
+                error("invalid value `%s` for `%s`", sweep.values[a][v], AXIS_KEYS[a]);
+            }
+            if (BENCH_AXIS_RANKS == a && nb_ranks > size) {
+                if (rank == 0) {
+                    warn("skipping %d ranks, only %d are available", nb_ranks, size);
+                }
+                sweep.values[a][v--] = sweep.values[a][--sweep.nb_values[a]];
+            }
+        }
+    }
+    if (NULL != sweep.lists[BENCH_AXIS_RANKS] && 0 == sweep.nb_values[BENCH_AXIS_RANKS]) {
+        error("no rank count of `ranks` fits in the %d available ranks", size);
+    }
+
+    FILE* ofp = NULL;
+    if (rank == 0 && NULL != output_path) {
+        ofp = fopen(output_path, "w");
+        if (NULL == ofp) {
+            error("failed to open output file `%s`", output_path);
+        }
+    } else if (rank == 0) {
+        ofp = stdout;
+    }
+    if (rank == 0) {
+        fprintf(
+            ofp,
+            "scaling,ranks,grid_x,grid_y,grid_z,threads,kernel,order,tile_x,tile_y,tile_z,"
+            "dim_x,dim_y,dim_z,local_x,local_y,local_z,warmup,repeat,"
+            "min_s,median_s,mean_s,ci95_lo_s,ci95_hi_s,cells_per_s\n"
+        );
+    }
+
+    // Combinations are enumerated with the last axis varying fastest, an axis without values
+    // counting as one
+    usz indices[BENCH_NB_AXES] = {0};
+    bool done = false;
+    while (!done) {
+        config_t run = cfg;
+        i32 nb_ranks = size;
+        for (usz a = 0; a < BENCH_NB_AXES; ++a) {
+            if (sweep.nb_values[a] > 0) {
+                axis_apply((bench_axis_t)a, sweep.values[a][indices[a]], &run, &nb_ranks);
+            }
+        }
+        bench_run(&run, nb_ranks, &sweep, ofp);
+
+        done = true;
+        for (usz a = BENCH_NB_AXES; a-- > 0;) {
+            if (indices[a] + 1 < sweep.nb_values[a]) {
+                indices[a] += 1;
+                done = false;
+                break;
+            }
+            indices[a] = 0;
+        }
+    }
+
+    for (usz a = 0; a < BENCH_NB_AXES; ++a) {
+        free(sweep.lists[a]);
+    }
+    if (NULL != ofp) {
+        fclose(ofp);
+    }
+    MPI_Finalize();
+    return 0;
+}
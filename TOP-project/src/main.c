@@ -1,23 +1,29 @@
 #include "chrono.h"
 #include "logging.h"
+#include "stencil/checkpoint.h"
 #include "stencil/comm_handler.h"
 #include "stencil/config.h"
 #include "stencil/init.h"
+#include "stencil/instrument.h"
 #include "stencil/mesh.h"
+#include "stencil/metrics.h"
+#include "stencil/perf.h"
+#include "stencil/snapshot.h"
 #include "stencil/solve.h"
+#include "stencil/team.h"
+#include "stencil/tune.h"
 
 #include <mpi.h>
+#include <omp.h>
 #include <stdio.h>
+#include <string.h>
 
 static char* DEFAULT_CONFIG_PATH = "../config.txt";
 static char* DEFAULT_OUTPUT_PATH = NULL;
 
-static void save_results(
-    FILE ofp[static 1],
-    config_t const* cfg,
-    mesh_t const* mesh,
-    comm_handler_t const* comm_handler,
-    duration_t elapsed
+/// Builds a probe on the center cell of the global mesh, active on the rank that owns it.
+static solve_probe_t center_probe(
+    config_t const* cfg, comm_handler_t const* comm_handler, f64 values[static 1]
 ) {
     usz const mid_x = cfg->dim_x / 2;
     usz const mid_y = cfg->dim_y / 2;
@@ -35,125 +41,579 @@ static void save_results(
             ? true
             : false;
 
-    f64 loc_elapsed_s = duration_as_s_f64(elapsed);
-    f64 loc_ns_per_elem =
-        duration_as_ns_f64(elapsed) / (f64)cfg->dim_x / (f64)cfg->dim_y / (f64)cfg->dim_z;
-    f64 glob_elapsed_s;
-    f64 glob_ns_per_elem;
+    return (solve_probe_t){
+        .active = mid_x_is_in && mid_y_is_in && mid_z_is_in,
+        .i = mid_x - comm_handler->coord_x + cfg->order * cfg->halo_depth,
+        .j = mid_y - comm_handler->coord_y + cfg->order * cfg->halo_depth,
+        .k = mid_z - comm_handler->coord_z + cfg->order * cfg->halo_depth,
+        .values = values,
+    };
+}
 
-    i32 rank;
-    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-    i32 comm_size;
-    MPI_Comm_size(MPI_COMM_WORLD, &comm_size);
-    MPI_Allreduce(&loc_elapsed_s, &glob_elapsed_s, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-    MPI_Allreduce(&loc_ns_per_elem, &glob_ns_per_elem, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-
-    if (mid_x_is_in && mid_y_is_in && mid_z_is_in) {
-        fprintf(
-            ofp,
-            "%+18.15lf %12.9lf %12.3lf %zu %zu %zu\n",
-            mesh->cells[mid_x - comm_handler->coord_x + STENCIL_ORDER]
-                       [mid_y - comm_handler->coord_y + STENCIL_ORDER]
-                       [mid_z - comm_handler->coord_z + STENCIL_ORDER]
-                           .value,
-            glob_elapsed_s / (f64)comm_size,
-            glob_ns_per_elem / (f64)comm_size,
-            cfg->dim_x,
-            cfg->dim_y,
-            cfg->dim_z
+/// Picks the tile shape of `solver` and the thread count, from the tuning cache or from a search
+/// on the local mesh (always searched if `force` is set), with at most `nb_threads` threads. Ranks
+/// with the same local mesh share them (see `tune_shared`). Returns the thread count.
+static usz autotune(
+    solver_t* solver,
+    config_t const* cfg,
+    comm_handler_t const* comm_handler,
+    usz nb_threads,
+    bool force
+) {
+    tune_key_t key = tune_key_new(
+        solver,
+        cfg->sweep,
+        cfg->product,
+        comm_handler->loc_dim_x,
+        comm_handler->loc_dim_y,
+        comm_handler->loc_dim_z,
+        nb_threads
+    );
+    tune_params_t const params = tune_shared(
+        comm_handler->comm, solver, &key, config_tune_cache(cfg), cfg->alloc, force
+    );
+
+    solver->tile = params.tile;
+    return params.nb_threads;
+}
+
+/// Reads the weight of `rank` in the split of the mesh from the weights file at `path`, one
+/// positive number per line in rank order.
+static f64 read_weight(char const path[static 1], i32 rank) {
+    FILE* fp = fopen(path, "rb");
+    if (NULL == fp) {
+        error("failed to open weights file `%s`", path);
+    }
+
+    f64 weight = 0.0;
+    i32 r = 0;
+    usz line_len = 0;
+    char* line = NULL;
+    while (r <= rank && -1 != getline(&line, &line_len, fp)) {
+        if ('#' == line[0] || '\n' == line[0]) {
+            continue;
+        }
+        if (r == rank && (1 != sscanf(line, "%lf", &weight) || !(weight > 0.0))) {
+            error("invalid weight `%s` for rank %d in `%s`", strtok(line, "\n"), rank, path);
+        }
+        r += 1;
+    }
+    free(line);
+    fclose(fp);
+    if (r <= rank) {
+        error("no weight for rank %d in `%s`", rank, path);
+    }
+    return weight;
+}
+
+/// Allocates a mesh of `kind` with the local dimensions of `comm_handler`. Exchanged meshes are
+/// allocated by the communication handler, in shared memory if ghost cells are copied directly
+/// from the neighbors on the node.
+static mesh_t local_mesh_new(
+    comm_handler_t* comm_handler, config_t const* cfg, mesh_kind_t kind
+) {
+    return comm_handler_mesh_new(
+        comm_handler,
+        comm_handler->loc_dim_x,
+        comm_handler->loc_dim_y,
+        comm_handler->loc_dim_z,
+        cfg->order,
+        cfg->halo_depth,
+        kind,
+        cfg->alloc
+    );
+}
+
+/// Splits the mesh again, weighting the ranks by their compute throughput over the first `nb_iters`
+/// iterations (which took `compute_s` seconds, exchanges excluded), and allocates the meshes again
+/// with the new local dimensions. Returns the current iterate `curr` (one of the meshes) moved to
+/// the new split, to be copied into it once the meshes are initialized.
+static mesh_t rebalance_meshes(
+    comm_handler_t* comm_handler,
+    config_t const* cfg,
+    f64 compute_s,
+    usz nb_iters,
+    mesh_t const* curr,
+    mesh_t* A,
+    mesh_t* B,
+    mesh_t* C,
+    mesh_t* P
+) {
+    f64 const weight = (f64)(comm_handler->loc_dim_x * comm_handler->loc_dim_y *
+                             comm_handler->loc_dim_z * nb_iters) /
+                       compute_s;
+    mesh_t moved = comm_handler_rebalance(comm_handler, weight, curr, cfg->alloc);
+
+    comm_handler_mesh_drop(comm_handler, A);
+    comm_handler_mesh_drop(comm_handler, B);
+    comm_handler_mesh_drop(comm_handler, C);
+    *A = local_mesh_new(comm_handler, cfg, MESH_KIND_INPUT);
+    *B = local_mesh_new(comm_handler, cfg, MESH_KIND_CONSTANT);
+    *C = local_mesh_new(comm_handler, cfg, MESH_KIND_OUTPUT);
+    if (NULL != P->values) {
+        mesh_drop(P);
+        *P = mesh_new(
+            comm_handler->loc_dim_x,
+            comm_handler->loc_dim_y,
+            comm_handler->loc_dim_z,
+            cfg->order,
+            1,
+            MESH_KIND_PRODUCT,
+            cfg->alloc
         );
     }
+    return moved;
+}
+
+/// Returns the name of an MPI thread support level.
+static char const* thread_level_as_str(i32 level) {
+    switch (level) {
+        case MPI_THREAD_SINGLE:
+            return "MPI_THREAD_SINGLE";
+        case MPI_THREAD_FUNNELED:
+            return "MPI_THREAD_FUNNELED";
+        case MPI_THREAD_SERIALIZED:
+            return "MPI_THREAD_SERIALIZED";
+        case MPI_THREAD_MULTIPLE:
+            return "MPI_THREAD_MULTIPLE";
+        default:
+            return "unknown";
+    }
 }
 
 i32 main(i32 argc, char* argv[argc + 1]) {
-    MPI_Init(&argc, &argv);
+    // Positional arguments are the configuration and output paths, `--key=value` options override
+    // the configuration file and `--tune` only searches the tuning parameters (see `tune.h`) and
+    // stores them in the tuning cache
+    char* config_path = DEFAULT_CONFIG_PATH;
+    char* output_path = DEFAULT_OUTPUT_PATH;
+    bool tune_only = false;
+    usz nb_positional = 0;
+    for (i32 a = 1; a < argc; ++a) {
+        if (strcmp("--tune", argv[a]) == 0) {
+            tune_only = true;
+        } else if (0 == strncmp("--", argv[a], 2)) {
+            continue;
+        } else if (0 == nb_positional) {
+            config_path = argv[a];
+            nb_positional += 1;
+        } else if (1 == nb_positional) {
+            output_path = argv[a];
+            nb_positional += 1;
+        } else {
+            error("unexpected argument `%s`", argv[a]);
+        }
+    }
+    config_t cfg = config_parse_from_file(config_path);
+    for (i32 a = 1; a < argc; ++a) {
+        if (0 != strncmp("--", argv[a], 2) || strcmp("--tune", argv[a]) == 0) {
+            continue;
+        }
+        char key[32];
+        char val[CONFIG_PATH_LEN];
+        if (2 != sscanf(argv[a] + 2, "%31[^=]=%255s", key, val) || !config_set(&cfg, key, val)) {
+            error("invalid option `%s`, expected `--key=value`", argv[a]);
+        }
+    }
+
+    // MPI is called by the master thread of the team, and by the progress thread if there is one
+    i32 const required = cfg.progress ? MPI_THREAD_MULTIPLE : MPI_THREAD_FUNNELED;
+    i32 provided;
+    MPI_Init_thread(&argc, &argv, required, &provided);
 
     i32 rank;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-    i32 comm_size;
-    MPI_Comm_size(MPI_COMM_WORLD, &comm_size);
-
-    char* config_path;
-    char* output_path;
-    if (2 == argc) {
-        config_path = argv[1];
-    } else if (3 == argc) {
-        config_path = argv[1];
-        output_path = argv[2];
-    } else {
-        config_path = DEFAULT_CONFIG_PATH;
-        output_path = DEFAULT_OUTPUT_PATH;
+    if (rank == 0) {
+        info(
+            "MPI thread support %s (required %s)",
+            thread_level_as_str(provided),
+            thread_level_as_str(required)
+        );
+    }
+    if (provided < required && rank == 0) {
+        warn("the MPI implementation only provides %s", thread_level_as_str(provided));
+    }
+    if (cfg.progress && provided < MPI_THREAD_MULTIPLE) {
+        if (rank == 0) {
+            warn("the progress thread needs %s, disabling it", "MPI_THREAD_MULTIPLE");
+        }
+        cfg.progress = false;
+    }
+    // Iterations between two exchanges compute the ghost cells of the next iterate, which must then
+    // be swapped with the current one and computed by the plain blocked sweep
+    if (cfg.halo_depth > 1 &&
+        (SOLVE_BUFFERING_SWAP != cfg.buffering || SOLVE_SWEEP_BLOCKED != cfg.sweep || cfg.product ||
+         cfg.time_block > 1)) {
+        if (rank == 0) {
+            warn(
+                "deep ghost layers need the `swap` buffering and the plain `blocked` sweep, "
+                "ignoring halo_depth=%zu",
+                cfg.halo_depth
+            );
+        }
+        cfg.halo_depth = 1;
     }
-    config_t cfg = config_parse_from_file(config_path);
 #ifndef NDEBUG
     if (rank == 0) {
         config_print(&cfg);
     }
 #endif
 
-    FILE* ofp;
-    if (NULL != output_path) {
+    team_t team = team_new(cfg.threads, cfg.affinity, cfg.progress, MPI_COMM_WORLD);
+    solver_t solver = solver_new(cfg.simd, cfg.order, cfg.tile);
+    if (rank == 0) {
+        info("using `%s` stencil kernel of order %zu", solver.kernel->name, solver.kernel->order);
+    }
+
+    // Ranks get shares of the mesh proportional to their weight
+    f64 weight = 1.0;
+    if (COMM_BALANCE_CALIBRATE == cfg.balance) {
+        weight = tune_calibrate(&solver, team.nb_threads, cfg.alloc);
+    } else if (COMM_BALANCE_FILE == cfg.balance) {
+        weight = read_weight(config_weights(&cfg), rank);
+    }
+    comm_handler_t comm_handler = comm_handler_new(
+        MPI_COMM_WORLD,
+        cfg.dim_x,
+        cfg.dim_y,
+        cfg.dim_z,
+        cfg.order * cfg.halo_depth,
+        weight,
+        cfg.exchange
+    );
+#ifndef NDEBUG
+    comm_handler_print(&comm_handler);
+    team_print(&team, rank);
+#endif
+
+    if (tune_only || cfg.autotune) {
+        team.nb_threads = autotune(&solver, &cfg, &comm_handler, team.nb_threads, tune_only);
+    }
+    if (tune_only) {
+        comm_handler_drop(&comm_handler);
+        team_drop(&team);
+        MPI_Finalize();
+        return 0;
+    }
+    if (cfg.progress) {
+        comm_handler_progress_start(&comm_handler, team.progress_cpu);
+    }
+    if (rank == 0) {
+        info("using %zu threads per rank", team.nb_threads);
+    }
+
+    // Results are aggregated and written by rank 0
+    FILE* ofp = NULL;
+    if (rank == 0 && NULL != output_path) {
         ofp = fopen(output_path, "wb");
         if (NULL == ofp) {
             error("failed to open output file `%s`", output_path);
         }
-    } else {
+    } else if (rank == 0) {
         ofp = stdout;
     }
 
-    comm_handler_t comm_handler =
-        comm_handler_new((u32)rank, (u32)comm_size, cfg.dim_x, cfg.dim_y, cfg.dim_z);
-#ifndef NDEBUG
-    comm_handler_print(&comm_handler);
-#endif
+    // Temporal blocking keeps ghost cells across iterations, which requires not having neighbors
+    usz time_block = cfg.time_block;
+    if (time_block > 1 && comm_handler_has_neighbors(&comm_handler)) {
+        if (rank == 0) {
+            warn("temporal blocking needs a single rank per mesh, ignoring time_block=%zu", time_block);
+        }
+        time_block = 1;
+    }
+    // Temporally blocked sweeps run the plain kernel on A and B, neither on their product nor
+    // streaming along X
+    if (time_block > 1 && (cfg.product || SOLVE_SWEEP_BLOCKED != cfg.sweep)) {
+        if (rank == 0) {
+            warn(
+                "temporal blocking runs the plain `blocked` sweep, ignoring product=%d and "
+                "sweep=%s",
+                cfg.product,
+                (SOLVE_SWEEP_BLOCKED == cfg.sweep) ? "blocked" : "streaming"
+            );
+        }
+        cfg.product = false;
+        cfg.sweep = SOLVE_SWEEP_BLOCKED;
+    }
 
-    mesh_t A = mesh_new(
-        comm_handler.loc_dim_x, comm_handler.loc_dim_y, comm_handler.loc_dim_z, MESH_KIND_INPUT
-    );
-    mesh_t B = mesh_new(
-        comm_handler.loc_dim_x, comm_handler.loc_dim_y, comm_handler.loc_dim_z, MESH_KIND_CONSTANT
-    );
-    mesh_t C = mesh_new(
-        comm_handler.loc_dim_x, comm_handler.loc_dim_y, comm_handler.loc_dim_z, MESH_KIND_OUTPUT
+    mesh_t A = local_mesh_new(&comm_handler, &cfg, MESH_KIND_INPUT);
+    mesh_t B = local_mesh_new(&comm_handler, &cfg, MESH_KIND_CONSTANT);
+    mesh_t C = local_mesh_new(&comm_handler, &cfg, MESH_KIND_OUTPUT);
+    // Pointwise product A*B, only used when it is precomputed once per iteration
+    mesh_t P = {0};
+    if (cfg.product && SOLVE_SWEEP_BLOCKED == cfg.sweep) {
+        P = mesh_new(
+            comm_handler.loc_dim_x,
+            comm_handler.loc_dim_y,
+            comm_handler.loc_dim_z,
+            cfg.order,
+            1,
+            MESH_KIND_PRODUCT,
+            cfg.alloc
+        );
+    }
+
+    // Overlapping sends the faces of the next iterate while it is computed, which requires it not to
+    // be copied into the current one
+    bool const overlap = cfg.overlap && SOLVE_BUFFERING_SWAP == cfg.buffering &&
+                         SOLVE_SWEEP_BLOCKED == cfg.sweep && 1 == cfg.halo_depth &&
+                         comm_handler_has_neighbors(&comm_handler);
+    // Neighbors in face order, deep ghost layers are only computed on the sides that have one
+    i32 const face_ids[6] = {
+        comm_handler.id_left,
+        comm_handler.id_right,
+        comm_handler.id_top,
+        comm_handler.id_bottom,
+        comm_handler.id_front,
+        comm_handler.id_back,
+    };
+    f64* center_values = malloc(time_block * sizeof(f64));
+    solve_probe_t probe = center_probe(&cfg, &comm_handler, center_values);
+    metrics_t metrics = metrics_new(
+        MPI_COMM_WORLD, cfg.dim_x, cfg.dim_y, cfg.dim_z, cfg.niter, cfg.metrics_batch, ofp
     );
-    init_meshes(&A, &B, &C, &comm_handler);
+    snapshot_t snapshot = {.file = MPI_FILE_NULL};
+    if (cfg.snapshot > 0) {
+        snapshot = snapshot_new(
+            &comm_handler, cfg.snapshot_path, cfg.snapshot_region, cfg.snapshot_step
+        );
+    }
+    // A restart maps the current iterate and the constant mesh from the checkpoints, or gathers
+    // their core cells to copy them once the meshes are initialized
+    checkpoint_restart_t restart = {0};
+    if (cfg.restart) {
+        restart = checkpoint_restart(&comm_handler, cfg.checkpoint_path, &A, &B, cfg.alloc);
+        if (rank == 0) {
+            info("restart after %zu iterations", restart.iteration);
+        }
+    }
+    checkpoint_t checkpoint = {0};
+    if (cfg.checkpoint > 0) {
+        checkpoint = checkpoint_new(&comm_handler, cfg.checkpoint_path);
+    }
 
-    // Exchange ghost cells to make sure data is properly initialized everywhere
-    comm_handler_ghost_exchange(&comm_handler, &A);
-    comm_handler_ghost_exchange(&comm_handler, &B);
-    comm_handler_ghost_exchange(&comm_handler, &C);
+    // Ceilings of the roofline are measured by all the ranks at once, the phases of the run are
+    // then timed (and their events counted) from scratch, leaving out the sweeps of the tuning
+    perf_ceilings_t ceilings = {0};
+    if (cfg.perf) {
+        ceilings = perf_measure_ceilings(&solver, team.nb_threads, MPI_COMM_WORLD);
+    }
+    instrument_reset();
 
     chrono_t chrono;
+    // Compute time of the iterations (exchanges excluded), and current iterate moved to the new
+    // split when rebalancing
+    f64 compute_s = 0.0;
+    mesh_t moved = {0};
 #ifndef NDEBUG
     if (rank == 0) {
         fprintf(stderr, "****************************************\n");
     }
 #endif
-    for (usz it = 0; it < cfg.niter; ++it) {
-#ifndef NDEBUG
-        if (rank == 0) {
-            fprintf(stderr, "Iteration #%2zu/%2zu\r", it + 1, cfg.niter);
+
+    // A single team of threads, pinned once, first-touches the meshes and then computes them.
+    // MPI calls are made by the master thread, the others wait for them at a barrier.
+    #pragma omp parallel num_threads(team.nb_threads)
+    {
+        team_pin(&team);
+        if (cfg.perf) {
+            instrument_events_open();
+        }
+        if ('\0' != cfg.trace[0]) {
+            instrument_trace_open(cfg.trace_events);
         }
+        if (restart.mapped) {
+            init_mesh(&C, &comm_handler, solver.tile);
+        } else {
+            init_meshes(&A, &B, &C, &comm_handler, solver.tile);
+        }
+        if (NULL != restart.A.values) {
+            mesh_copy_core(&A, &restart.A);
+            mesh_copy_core(&B, &restart.B);
+        }
+
+        // Exchange ghost cells to make sure data is properly initialized everywhere
+        #pragma omp master
+        {
+            checkpoint_restart_drop(&restart);
+            comm_handler_ghost_exchange(&comm_handler, &A);
+            comm_handler_ghost_exchange(&comm_handler, &B);
+            comm_handler_ghost_exchange(&comm_handler, &C);
+        }
+        instrument_barrier();
+
+        // Current and next iterates, their roles are swapped (or the next one is copied into the
+        // current one) at the end of every iteration. Every thread swaps its own copy.
+        mesh_t* curr = &A;
+        mesh_t* next = &C;
+        bool rebalanced = false;
+
+        for (usz it = restart.iteration; it < cfg.niter;) {
+            usz const nb_steps = (cfg.niter - it < time_block) ? cfg.niter - it : time_block;
+            #pragma omp master
+            {
+#ifndef NDEBUG
+                if (rank == 0) {
+                    fprintf(stderr, "Iteration #%2zu/%2zu\r", it + nb_steps, cfg.niter);
+                }
 #endif
+                INSTRUMENT_MARK("iteration", it);
+                chrono_start(&chrono);
+            }
+            instrument_barrier();
+
+            if (nb_steps > 1) {
+                // Compute `nb_steps` Jacobi iterations at once, the result lands in `next` after
+                // an odd number of them
+                solve_jacobi_temporal(&solver, curr, &B, next, nb_steps, &probe);
+                if (1 == nb_steps % 2) {
+                    solve_commit(&curr, &next, cfg.buffering);
+                }
+            } else {
+                // Compute Jacobi C=B@A (one iteration)
+                if (overlap) {
+                    solve_jacobi_overlap(
+                        &solver, curr, &B, next, cfg.product ? &P : NULL, &comm_handler
+                    );
+                } else if (cfg.halo_depth > 1) {
+                    // The ghost cells read until the next exchange are computed as well, that is
+                    // one order less at every iteration since the last one
+                    usz const reach = (cfg.halo_depth - 1 - it % cfg.halo_depth) * cfg.order;
+                    usz extents[6];
+                    for (usz n = 0; n < 6; ++n) {
+                        extents[n] = (face_ids[n] >= 0) ? reach : 0;
+                    }
+                    solve_jacobi_extended(&solver, curr, &B, next, extents);
+                } else if (SOLVE_SWEEP_STREAMING == cfg.sweep) {
+                    solve_jacobi_streaming(&solver, curr, &B, next);
+                } else if (cfg.product) {
+                    solve_product(&solver, curr, &B, &P);
+                    solve_jacobi_product(&solver, &P, next);
+                } else {
+                    solve_jacobi(&solver, curr, &B, next);
+                }
+                solve_commit(&curr, &next, cfg.buffering);
+            }
+
+            #pragma omp master
+            {
+                chrono_t compute = chrono;
+                chrono_stop(&compute);
+                f64 const step_compute_s = duration_as_s_f64(chrono_elapsed(compute));
+                compute_s += step_compute_s;
+                if (1 == nb_steps && probe.active) {
+                    probe.values[0] = idx_const(curr, probe.i, probe.j, probe.k);
+                }
+
+                // Exchange ghost cells of the current iterate (or complete their exchange, started
+                // during the sweep)
+                // No need to exchange B as its a constant mesh, nor the next iterate as its ghost
+                // cells are never read
+                // Deep ghost layers are only exchanged every `halo_depth` iterations, and after the
+                // last one
+                if (overlap && 1 == nb_steps) {
+                    comm_handler_ghost_finish(&comm_handler, curr);
+                } else if (0 == (it + nb_steps) % cfg.halo_depth || it + nb_steps == cfg.niter) {
+                    comm_handler_ghost_exchange(&comm_handler, curr);
+                }
+                chrono_stop(&chrono);
 
-        chrono_start(&chrono);
-        // Compute Jacobi C=B@A (one iteration)
-        solve_jacobi(&A, &B, &C);
+                // Timings are only buffered, and aggregated once a batch is complete
+                f64 const elapsed_s = duration_as_s_f64(chrono_elapsed(chrono));
+                for (usz s = 0; s < nb_steps; ++s) {
+                    metrics_record(
+                        &metrics,
+                        elapsed_s / (f64)nb_steps,
+                        step_compute_s / (f64)nb_steps,
+                        probe.active,
+                        probe.values[s]
+                    );
+                }
 
-        // Exchange ghost cells for A and C meshes
-        // No need to exchange B as its a constant mesh
-        comm_handler_ghost_exchange(&comm_handler, &A);
-        comm_handler_ghost_exchange(&comm_handler, &C);
-        chrono_stop(&chrono);
+                // Snapshots are packed here, and written while the next iterations run
+                if (cfg.snapshot > 0 && (it + nb_steps) / cfg.snapshot > it / cfg.snapshot) {
+                    snapshot_write(&snapshot, curr, it + nb_steps);
+                }
+                if (cfg.checkpoint > 0 && (it + nb_steps) / cfg.checkpoint > it / cfg.checkpoint) {
+                    checkpoint_write(&checkpoint, &comm_handler, curr, &B, it + nb_steps);
+                }
+            }
+            instrument_barrier();
+            it += nb_steps;
 
-        duration_t elapsed = chrono_elapsed(chrono);
-        save_results(ofp, &cfg, &A, &comm_handler, elapsed);
+            // The current iterate is moved to the new split, the other meshes are initialized
+            // again (the next iterate is entirely overwritten)
+            if (!rebalanced && cfg.rebalance > 0 && it >= restart.iteration + cfg.rebalance &&
+                it < cfg.niter)
+            {
+                rebalanced = true;
+                #pragma omp master
+                {
+                    // The checkpoint in flight still reads the constant mesh
+                    checkpoint_wait(&checkpoint);
+                    moved = rebalance_meshes(
+                        &comm_handler,
+                        &cfg,
+                        compute_s,
+                        it - restart.iteration,
+                        curr,
+                        &A,
+                        &B,
+                        &C,
+                        &P
+                    );
+                    if (cfg.snapshot > 0) {
+                        snapshot_resplit(&snapshot, &comm_handler);
+                    }
+                }
+                instrument_barrier();
+                init_meshes(&A, &B, &C, &comm_handler, solver.tile);
+                mesh_copy_core(curr, &moved);
+                #pragma omp master
+                {
+                    mesh_drop(&moved);
+                    comm_handler_ghost_exchange(&comm_handler, curr);
+                    comm_handler_ghost_exchange(&comm_handler, &B);
+                    probe = center_probe(&cfg, &comm_handler, center_values);
+                    if (rank == 0) {
+                        info("split the mesh again after %zu iterations", it);
+                    }
+#ifndef NDEBUG
+                    comm_handler_print(&comm_handler);
+#endif
+                }
+                instrument_barrier();
+            }
+        }
     }
 
-    mesh_drop(&A);
-    mesh_drop(&B);
-    mesh_drop(&C);
-    fclose(ofp);
+    metrics_finish(&metrics);
+    metrics_drop(&metrics);
+    if ('\0' != cfg.instrument[0]) {
+        instrument_report(MPI_COMM_WORLD, cfg.instrument);
+    }
+    if ('\0' != cfg.trace[0]) {
+        instrument_trace_write(MPI_COMM_WORLD, cfg.trace);
+    }
+    if (cfg.perf) {
+        instrument_roofline(
+            MPI_COMM_WORLD, solver.kernel->name, perf_flops_per_cell(cfg.order), ceilings
+        );
+    }
+    if (cfg.snapshot > 0) {
+        snapshot_drop(&snapshot);
+    }
+    checkpoint_drop(&checkpoint);
+    free(center_values);
+    comm_handler_mesh_drop(&comm_handler, &A);
+    comm_handler_mesh_drop(&comm_handler, &B);
+    comm_handler_mesh_drop(&comm_handler, &C);
+    mesh_drop(&P);
+    comm_handler_drop(&comm_handler);
+    team_drop(&team);
+    if (NULL != ofp) {
+        fclose(ofp);
+    }
 
     MPI_Finalize();
     return 0;
@@ -0,0 +1,363 @@
+#define _GNU_SOURCE
+
+#include "stencil/checkpoint.h"
+#include "logging.h"
+#include "stencil/instrument.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/// Size of a page, the alignment of the meshes in a checkpoint file.
+#define PAGE_SIZE 4096UL
+
+_Static_assert(
+    sizeof(checkpoint_header_t) <= CHECKPOINT_HEADER_SIZE, "checkpoint header must fit its size"
+);
+
+/// Returns the path of the checkpoint file of `rank` (to be freed).
+static char* rank_path(char const* path, u64 rank) {
+    char* out;
+    if (asprintf(&out, "%s.%lu", path, rank) < 0) {
+        error("failed to format checkpoint path for rank %lu", rank);
+    }
+    return out;
+}
+
+/// Reads the header of the checkpoint file at `path`. Returns false if it is missing or invalid.
+static bool read_header(char const* path, checkpoint_header_t* out) {
+    i32 const fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool const ok = (ssize_t)sizeof(*out) == pread(fd, out, sizeof(*out), 0) &&
+                    0 == memcmp(out->magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) &&
+                    CHECKPOINT_VERSION == out->version;
+    close(fd);
+    return ok;
+}
+
+/// Writes `size` bytes of `buf` at `offset` in `fd`. Returns false on failure.
+static bool write_all(i32 fd, void const* buf, usz size, usz offset) {
+    u8 const* cur = buf;
+    while (size > 0) {
+        ssize_t const n = pwrite(fd, cur, size, (off_t)offset);
+        if (n < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return false;
+        }
+        cur += n;
+        offset += (usz)n;
+        size -= (usz)n;
+    }
+    return true;
+}
+
+checkpoint_t checkpoint_new(comm_handler_t const* comm_handler, char const path[static 1]) {
+    return (checkpoint_t){
+        .path = path,
+        .file_path = rank_path(path, (u64)comm_handler->rank),
+    };
+}
+
+/// Body of the writer thread: writes the checkpoint in flight to a temporary file, then renames
+/// it over the previous one.
+static void* write_checkpoint(void* arg) {
+    checkpoint_t const* self = arg;
+    char* tmp_path;
+    if (asprintf(&tmp_path, "%s.tmp", self->file_path) < 0) {
+        warn("failed to write checkpoint %s", self->file_path);
+        return NULL;
+    }
+
+    i32 const fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        warn("failed to open checkpoint %s: %s", tmp_path, strerror(errno));
+        free(tmp_path);
+        return NULL;
+    }
+    u8 header[CHECKPOINT_HEADER_SIZE] = {0};
+    memcpy(header, &self->header, sizeof(self->header));
+    usz const size = self->header.mesh_size;
+    bool const ok = write_all(fd, header, sizeof(header), 0) &&
+                    write_all(fd, self->staging, size, self->header.offsets[0]) &&
+                    write_all(fd, self->constant->values, size, self->header.offsets[1]) &&
+                    0 == fdatasync(fd);
+    close(fd);
+    if (!ok || 0 != rename(tmp_path, self->file_path)) {
+        warn("failed to write checkpoint %s: %s", self->file_path, strerror(errno));
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+    return NULL;
+}
+
+void checkpoint_write(
+    checkpoint_t* self,
+    comm_handler_t const* comm_handler,
+    mesh_t const* curr,
+    mesh_t const* B,
+    usz iteration
+) {
+    INSTRUMENT_SCOPE(INSTRUMENT_PHASE_OUTPUT);
+    checkpoint_wait(self);
+
+    // The layout size excludes the rounding of the mapping to (huge) pages
+    mesh_t const layout = mesh_layout(
+        comm_handler->loc_dim_x,
+        comm_handler->loc_dim_y,
+        comm_handler->loc_dim_z,
+        curr->order,
+        curr->ghost / curr->order,
+        curr->kind
+    );
+    if (self->capacity < layout.size) {
+        free(self->staging);
+        self->staging = malloc(layout.size);
+        self->capacity = layout.size;
+    }
+    memcpy(self->staging, curr->values, layout.size);
+
+    i32 nb_ranks;
+    MPI_Comm_size(comm_handler->comm, &nb_ranks);
+    self->header = (checkpoint_header_t){
+        .version = CHECKPOINT_VERSION,
+        .iteration = iteration,
+        .nb_ranks = (u64)nb_ranks,
+        .rank = (u64)comm_handler->rank,
+        .global_dims = {comm_handler->dim_x, comm_handler->dim_y, comm_handler->dim_z},
+        .coords = {comm_handler->coord_x, comm_handler->coord_y, comm_handler->coord_z},
+        .loc_dims = {comm_handler->loc_dim_x, comm_handler->loc_dim_y, comm_handler->loc_dim_z},
+        .order = curr->order,
+        .ghost = curr->ghost,
+        .stride_x = curr->stride_x,
+        .stride_y = curr->stride_y,
+        .mesh_size = layout.size,
+        .offsets =
+            {
+                CHECKPOINT_HEADER_SIZE,
+                CHECKPOINT_HEADER_SIZE + round_up(layout.size, PAGE_SIZE),
+            },
+    };
+    memcpy(self->header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    self->constant = B;
+    INSTRUMENT_COUNT(INSTRUMENT_PHASE_OUTPUT, INSTRUMENT_COUNTER_BYTES, 2 * layout.size);
+
+    i32 const rc = pthread_create(&self->thread, NULL, write_checkpoint, self);
+    if (0 != rc) {
+        error("failed to start checkpoint writer thread: %s", strerror(rc));
+    }
+    self->running = true;
+}
+
+void checkpoint_wait(checkpoint_t* self) {
+    if (self->running) {
+        pthread_join(self->thread, NULL);
+        self->running = false;
+    }
+}
+
+void checkpoint_drop(checkpoint_t* self) {
+    checkpoint_wait(self);
+    free(self->staging);
+    free(self->file_path);
+    *self = (checkpoint_t){0};
+}
+
+/// Returns whether the checkpoint described by `header` has the layout of the local mesh `mesh`.
+static bool same_layout(
+    checkpoint_header_t const* header, comm_handler_t const* comm_handler, mesh_t const* mesh
+) {
+    i32 nb_ranks;
+    MPI_Comm_size(comm_handler->comm, &nb_ranks);
+    return (u64)nb_ranks == header->nb_ranks && comm_handler->coord_x == header->coords[0] &&
+           comm_handler->coord_y == header->coords[1] &&
+           comm_handler->coord_z == header->coords[2] &&
+           comm_handler->loc_dim_x == header->loc_dims[0] &&
+           comm_handler->loc_dim_y == header->loc_dims[1] &&
+           comm_handler->loc_dim_z == header->loc_dims[2] && mesh->ghost == header->ghost &&
+           mesh->stride_x == header->stride_x && mesh->stride_y == header->stride_y;
+}
+
+/// Maps the meshes of the checkpoint at `path` in place of the storage of `A` and `B`.
+static void map_meshes(char const* path, checkpoint_header_t const* header, mesh_t* A, mesh_t* B) {
+    i32 const fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        error("failed to open checkpoint %s: %s", path, strerror(errno));
+    }
+    mesh_t* meshes[2] = {A, B};
+    for (usz m = 0; m < 2; ++m) {
+        void* p = mmap(
+            meshes[m]->values,
+            round_up(header->mesh_size, PAGE_SIZE),
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_FIXED,
+            fd,
+            (off_t)header->offsets[m]
+        );
+        if (MAP_FAILED == p) {
+            error("failed to map checkpoint %s: %s", path, strerror(errno));
+        }
+    }
+    close(fd);
+}
+
+/// Copies the core cells of the checkpoint at `path` overlapping the local mesh into `A` and `B`
+/// (laid out like the local meshes). Returns the number of cells copied.
+static usz gather_meshes(
+    char const* path,
+    checkpoint_header_t const* header,
+    comm_handler_t const* comm_handler,
+    mesh_t* A,
+    mesh_t* B
+) {
+    usz const coords[3] = {comm_handler->coord_x, comm_handler->coord_y, comm_handler->coord_z};
+    usz const loc_dims[3] = {
+        comm_handler->loc_dim_x,
+        comm_handler->loc_dim_y,
+        comm_handler->loc_dim_z,
+    };
+    usz lo[3];
+    usz hi[3];
+    for (usz a = 0; a < 3; ++a) {
+        lo[a] = (coords[a] > header->coords[a]) ? coords[a] : header->coords[a];
+        usz const end = coords[a] + loc_dims[a];
+        usz const header_end = header->coords[a] + header->loc_dims[a];
+        hi[a] = (end < header_end) ? end : header_end;
+        if (lo[a] >= hi[a]) {
+            return 0;
+        }
+    }
+
+    i32 const fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        error("failed to open checkpoint %s: %s", path, strerror(errno));
+    }
+    usz const file_size = header->offsets[1] + header->mesh_size;
+    u8 const* file = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (MAP_FAILED == file) {
+        error("failed to map checkpoint %s: %s", path, strerror(errno));
+    }
+    close(fd);
+
+    // Rows along Z are contiguous in both layouts
+    usz const g = A->ghost;
+    usz const hg = header->ghost;
+    usz const row_len = (hi[2] - lo[2]) * sizeof(f64);
+    mesh_t* meshes[2] = {A, B};
+    for (usz m = 0; m < 2; ++m) {
+        f64 const* values = (f64 const*)(file + header->offsets[m]);
+        for (usz x = lo[0]; x < hi[0]; ++x) {
+            for (usz y = lo[1]; y < hi[1]; ++y) {
+                usz const src = (x - header->coords[0] + hg) * header->stride_x +
+                                (y - header->coords[1] + hg) * header->stride_y +
+                                (lo[2] - header->coords[2] + hg);
+                memcpy(
+                    idx(meshes[m], x - coords[0] + g, y - coords[1] + g, lo[2] - coords[2] + g),
+                    values + src,
+                    row_len
+                );
+            }
+        }
+    }
+    munmap((void*)file, file_size);
+    return (hi[0] - lo[0]) * (hi[1] - lo[1]) * (hi[2] - lo[2]);
+}
+
+checkpoint_restart_t checkpoint_restart(
+    comm_handler_t const* comm_handler,
+    char const path[static 1],
+    mesh_t* A,
+    mesh_t* B,
+    mesh_alloc_t alloc
+) {
+    checkpoint_restart_t self = {0};
+    char* own_path = rank_path(path, (u64)comm_handler->rank);
+    checkpoint_header_t own;
+
+    // Meshes in shared-memory windows, or backed by explicit huge pages, cannot be remapped
+    bool const mappable = COMM_EXCHANGE_SHARED != comm_handler->exchange &&
+                          MESH_PAGES_HUGETLB != alloc.pages && read_header(own_path, &own) &&
+                          own.global_dims[0] == comm_handler->dim_x &&
+                          own.global_dims[1] == comm_handler->dim_y &&
+                          own.global_dims[2] == comm_handler->dim_z && own.order == A->order &&
+                          same_layout(&own, comm_handler, A);
+    if (mappable) {
+        map_meshes(own_path, &own, A, B);
+        self.iteration = own.iteration;
+        self.mapped = true;
+    } else {
+        // The number of ranks of the checkpoints is read from the first one
+        char* p = rank_path(path, 0);
+        checkpoint_header_t first;
+        if (!read_header(p, &first)) {
+            error("failed to read checkpoint %s", p);
+        }
+        free(p);
+
+        usz const depth = A->ghost / A->order;
+        self.A = mesh_new(
+            comm_handler->loc_dim_x,
+            comm_handler->loc_dim_y,
+            comm_handler->loc_dim_z,
+            A->order,
+            depth,
+            A->kind,
+            alloc
+        );
+        self.B = mesh_new(
+            comm_handler->loc_dim_x,
+            comm_handler->loc_dim_y,
+            comm_handler->loc_dim_z,
+            B->order,
+            depth,
+            B->kind,
+            alloc
+        );
+        usz nb_copied = 0;
+        for (u64 r = 0; r < first.nb_ranks; ++r) {
+            checkpoint_header_t header;
+            p = rank_path(path, r);
+            if (!read_header(p, &header) || header.iteration != first.iteration ||
+                header.order != A->order || header.global_dims[0] != comm_handler->dim_x ||
+                header.global_dims[1] != comm_handler->dim_y ||
+                header.global_dims[2] != comm_handler->dim_z)
+            {
+                error("checkpoint %s is missing or does not match the others and the run", p);
+            }
+            nb_copied += gather_meshes(p, &header, comm_handler, &self.A, &self.B);
+            free(p);
+        }
+        if (nb_copied != comm_handler->loc_dim_x * comm_handler->loc_dim_y *
+                             comm_handler->loc_dim_z)
+        {
+            error("checkpoints %s.* do not cover the local mesh", path);
+        }
+        self.iteration = first.iteration;
+    }
+    free(own_path);
+
+    // Checkpoints of the ranks are written independently, a crash may leave them out of step
+    u64 iterations[2] = {self.iteration, ~(u64)self.iteration};
+    MPI_Allreduce(MPI_IN_PLACE, iterations, 2, MPI_UINT64_T, MPI_MAX, comm_handler->comm);
+    if (iterations[0] != ~iterations[1]) {
+        error(
+            "checkpoints %s.* were taken after different iterations (%lu to %lu)",
+            path,
+            ~iterations[1],
+            iterations[0]
+        );
+    }
+    return self;
+}
+
+void checkpoint_restart_drop(checkpoint_restart_t* self) {
+    mesh_drop(&self->A);
+    mesh_drop(&self->B);
+}
@@ -1,92 +1,312 @@
+#define _GNU_SOURCE
+
 #include "stencil/comm_handler.h"
 #include "logging.h"
+#include "stencil/instrument.h"
 
+#include <assert.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <stdio.h>
-#include <unistd.h>
-#include <omp.h>
-#include <math.h>
+#include <string.h>
+#include <time.h>
 
 #define MAXLEN 8UL
-#define BLOCK_SIZE_I 32
-#define BLOCK_SIZE_J 256
-#define BLOCK_SIZE_K 4
-// #define min(x, y) ((x) < (y) ? (x) : (y)) 
-#define min(x, y) (((x) <= (y)) * (x) + ((x) > (y)) * (y)) // speedup: no branching
-
-static u32 gcd(u32 a, u32 b) {
-    u32 c;
-    while (b != 0) {
-        c = a % b;
-        a = b;
-        b = c;
-    }
-    return a;
-}
+/// Pause (in nanoseconds) of the progress thread between two checks when no exchange is in flight.
+#define PROGRESS_IDLE_NS 20000L
 
 static char* stringify(char buf[static MAXLEN], i32 num) {
     snprintf(buf, MAXLEN, "%d", num);
     return buf;
 }
 
-comm_handler_t comm_handler_new(u32 rank, u32 comm_size, usz dim_x, usz dim_y, usz dim_z) {
-    // Compute splitting
-    u32 const nb_z = gcd(comm_size, (u32)(dim_x * dim_y));
-    u32 const nb_y = gcd(comm_size / nb_z, (u32)dim_z);
-    u32 const nb_x = (comm_size / nb_z) / nb_y;
+/// Total area (in cells) of the faces between the local meshes of a `nb_x * nb_y * nb_z` split.
+static usz halo_surface(usz dim_x, usz dim_y, usz dim_z, usz nb_x, usz nb_y, usz nb_z) {
+    return (nb_x - 1) * dim_y * dim_z + (nb_y - 1) * dim_x * dim_z + (nb_z - 1) * dim_x * dim_y;
+}
+
+/// Picks the split of `comm_size` ranks into `nbs[0] * nbs[1] * nbs[2]` local meshes that
+/// minimizes the halo surface, with at least `ghost` cells per local mesh along each axis. Ties
+/// are broken towards fewer cuts along Z, whose faces are the most scattered in memory.
+static bool split_ranks(i32 comm_size, usz const dims[static 3], usz ghost, i32 nbs[static 3]) {
+    usz const n = (usz)comm_size;
+    bool found = false;
+    usz best = 0;
+    for (usz nb_x = 1; nb_x <= n; ++nb_x) {
+        if (0 != n % nb_x || dims[0] / nb_x < ghost) {
+            continue;
+        }
+        for (usz nb_y = 1; nb_y <= n / nb_x; ++nb_y) {
+            usz const nb_z = n / nb_x / nb_y;
+            if (0 != (n / nb_x) % nb_y || dims[1] / nb_y < ghost || dims[2] / nb_z < ghost) {
+                continue;
+            }
+            usz const surface = halo_surface(dims[0], dims[1], dims[2], nb_x, nb_y, nb_z);
+            if (!found || surface < best || (surface == best && nb_z < (usz)nbs[2])) {
+                found = true;
+                best = surface;
+                nbs[0] = (i32)nb_x;
+                nbs[1] = (i32)nb_y;
+                nbs[2] = (i32)nb_z;
+            }
+        }
+    }
+    return found;
+}
+
+/// Splits `dim` cells into `nb` parts proportional to `weights`, of at least `min` cells each
+/// (`dim / nb` must be at least `min`). Part `c` starts at `starts[c]`, `starts[nb]` is `dim`.
+static void split_axis(usz dim, usz nb, f64 const* weights, usz min, usz* starts) {
+    f64 total = 0.0;
+    for (usz c = 0; c < nb; ++c) {
+        total += weights[c];
+    }
+    f64* shares = malloc(nb * sizeof(f64));
+    usz* lens = malloc(nb * sizeof(usz));
+    usz assigned = 0;
+    for (usz c = 0; c < nb; ++c) {
+        shares[c] = (f64)dim * weights[c] / total;
+        lens[c] = ((usz)shares[c] > min) ? (usz)shares[c] : min;
+        assigned += lens[c];
+    }
 
-    if (comm_size != nb_x * nb_y * nb_z) {
+    // Cells left by the rounding go to the parts furthest below their share, cells taken by the
+    // minimum come from the parts furthest above theirs
+    while (assigned < dim) {
+        usz best = 0;
+        for (usz c = 1; c < nb; ++c) {
+            if (shares[c] - (f64)lens[c] > shares[best] - (f64)lens[best]) {
+                best = c;
+            }
+        }
+        lens[best] += 1;
+        assigned += 1;
+    }
+    while (assigned > dim) {
+        usz best = nb;
+        for (usz c = 0; c < nb; ++c) {
+            if (lens[c] > min &&
+                (nb == best || shares[c] - (f64)lens[c] < shares[best] - (f64)lens[best])) {
+                best = c;
+            }
+        }
+        lens[best] -= 1;
+        assigned -= 1;
+    }
+
+    starts[0] = 0;
+    for (usz c = 0; c < nb; ++c) {
+        starts[c + 1] = starts[c] + lens[c];
+    }
+    free(lens);
+    free(shares);
+}
+
+/// Splits each axis of the global mesh among the slabs of ranks of the Cartesian communicator,
+/// weighted by the sum of the `weight`s of their ranks. Slab `c` of axis `a` starts at
+/// `starts[a][c]` (arrays of `nb + 1` entries, to be freed).
+static void split_axes(comm_handler_t const* self, f64 weight, usz* starts[static 3]) {
+    i32 comm_size;
+    MPI_Comm_size(self->comm, &comm_size);
+    f64* weights = malloc((usz)comm_size * sizeof(f64));
+    MPI_Allgather(&weight, 1, MPI_DOUBLE, weights, 1, MPI_DOUBLE, self->comm);
+
+    usz const dims[3] = {self->dim_x, self->dim_y, self->dim_z};
+    usz const nbs[3] = {self->nb_x, self->nb_y, self->nb_z};
+    for (usz a = 0; a < 3; ++a) {
+        f64* slabs = calloc(nbs[a], sizeof(f64));
+        for (i32 r = 0; r < comm_size; ++r) {
+            i32 coords[3];
+            MPI_Cart_coords(self->comm, r, 3, coords);
+            slabs[coords[a]] += weights[r];
+        }
+        starts[a] = malloc((nbs[a] + 1) * sizeof(usz));
+        split_axis(dims[a], nbs[a], slabs, self->min_dim, starts[a]);
+        free(slabs);
+    }
+    free(weights);
+}
+
+/// Sets the position and dimensions of the local mesh from the `starts` of the slabs of each axis.
+static void set_local_mesh(comm_handler_t* self, usz* const starts[static 3]) {
+    i32 coords[3];
+    MPI_Cart_coords(self->comm, self->rank, 3, coords);
+    self->coord_x = starts[0][coords[0]];
+    self->coord_y = starts[1][coords[1]];
+    self->coord_z = starts[2][coords[2]];
+    self->loc_dim_x = starts[0][coords[0] + 1] - self->coord_x;
+    self->loc_dim_y = starts[1][coords[1] + 1] - self->coord_y;
+    self->loc_dim_z = starts[2][coords[2] + 1] - self->coord_z;
+}
+
+/// Rank of a neighbor returned by `MPI_Cart_shift`, -1 if none.
+static i32 neighbor_id(i32 rank) {
+    return (MPI_PROC_NULL == rank) ? -1 : rank;
+}
+
+/// Ranks of the neighbors, in face order (low then high side of X, Y and Z).
+static void face_neighbors(comm_handler_t const* self, i32 ids[static COMM_NB_FACES]) {
+    ids[0] = self->id_left;
+    ids[1] = self->id_right;
+    ids[2] = self->id_top;
+    ids[3] = self->id_bottom;
+    ids[4] = self->id_front;
+    ids[5] = self->id_back;
+}
+
+/// Finds the neighbors on the node and allocates the synchronization flags of the shared-memory
+/// exchange.
+static void setup_node(comm_handler_t* self) {
+    MPI_Comm_split_type(
+        self->comm, MPI_COMM_TYPE_SHARED, self->rank, MPI_INFO_NULL, &self->node_comm
+    );
+    MPI_Group group;
+    MPI_Comm_group(self->comm, &group);
+    MPI_Group node_group;
+    MPI_Comm_group(self->node_comm, &node_group);
+
+    i32 ids[COMM_NB_FACES];
+    face_neighbors(self, ids);
+    for (usz f = 0; f < COMM_NB_FACES; ++f) {
+        self->node_ids[f] = -1;
+        if (ids[f] >= 0) {
+            i32 node_id;
+            MPI_Group_translate_ranks(group, 1, &ids[f], node_group, &node_id);
+            self->node_ids[f] = (MPI_UNDEFINED == node_id) ? -1 : node_id;
+        }
+    }
+    MPI_Group_free(&node_group);
+    MPI_Group_free(&group);
+
+    MPI_Win_allocate_shared(
+        2 * sizeof(u64), sizeof(u64), MPI_INFO_NULL, self->node_comm, &self->flags, &self->flags_win
+    );
+    self->flags[0] = 0;
+    self->flags[1] = 0;
+    for (usz f = 0; f < COMM_NB_FACES; ++f) {
+        self->peer_flags[f] = NULL;
+        if (self->node_ids[f] >= 0) {
+            MPI_Aint size;
+            i32 disp_unit;
+            MPI_Win_shared_query(
+                self->flags_win, self->node_ids[f], &size, &disp_unit, &self->peer_flags[f]
+            );
+        }
+    }
+    MPI_Barrier(self->node_comm);
+}
+
+comm_handler_t comm_handler_new(
+    MPI_Comm comm,
+    usz dim_x,
+    usz dim_y,
+    usz dim_z,
+    usz ghost,
+    f64 weight,
+    comm_exchange_t exchange
+) {
+    i32 comm_size;
+    MPI_Comm_size(comm, &comm_size);
+
+    // Compute splitting
+    usz const dims[3] = {dim_x, dim_y, dim_z};
+    i32 nbs[3];
+    if (!split_ranks(comm_size, dims, ghost, nbs)) {
         error(
-            "splitting does not match MPI communicator size\n -> expected %u, got %u",
+            "cannot split a %zux%zux%zu mesh among %d ranks with at least %zu cells per rank "
+            "along each axis",
+            dim_x,
+            dim_y,
+            dim_z,
             comm_size,
-            nb_x * nb_y * nb_z
+            ghost
         );
     }
+    return comm_handler_new_on_grid(comm, nbs, dim_x, dim_y, dim_z, ghost, weight, exchange);
+}
 
-    // Compute current rank position
-    u32 const rank_z = rank / (comm_size / nb_z);
-    u32 const rank_y = (rank % (comm_size / nb_z)) / (comm_size / nb_y);
-    u32 const rank_x = (rank % (comm_size / nb_z)) % (comm_size / nb_y);
-
-    // Setup size
-    usz const loc_dim_z = (rank_z == nb_z - 1) ? dim_z / nb_z + dim_z % nb_z : dim_z / nb_z;
-    usz const loc_dim_y = (rank_y == nb_y - 1) ? dim_y / nb_y + dim_y % nb_y : dim_y / nb_y;
-    usz const loc_dim_x = (rank_x == nb_x - 1) ? dim_x / nb_x + dim_x % nb_x : dim_x / nb_x;
+comm_handler_t comm_handler_new_on_grid(
+    MPI_Comm comm,
+    i32 const nbs[static 3],
+    usz dim_x,
+    usz dim_y,
+    usz dim_z,
+    usz ghost,
+    f64 weight,
+    comm_exchange_t exchange
+) {
+    i32 comm_size;
+    MPI_Comm_size(comm, &comm_size);
+    usz const dims[3] = {dim_x, dim_y, dim_z};
+    bool fits = nbs[0] * nbs[1] * nbs[2] == comm_size;
+    for (usz a = 0; a < 3; ++a) {
+        fits = fits && nbs[a] > 0 && dims[a] / (usz)nbs[a] >= ghost;
+    }
+    if (!fits) {
+        error(
+            "cannot split a %zux%zux%zu mesh among %d ranks as a %dx%dx%d grid with at least %zu "
+            "cells per rank along each axis",
+            dim_x,
+            dim_y,
+            dim_z,
+            comm_size,
+            nbs[0],
+            nbs[1],
+            nbs[2],
+            ghost
+        );
+    }
 
-    // Setup position
-    u32 const coord_z = rank_z * (u32)dim_z / nb_z;
-    u32 const coord_y = rank_y * (u32)dim_y / nb_y;
-    u32 const coord_x = rank_x * (u32)dim_x / nb_x;
+    // Let the MPI implementation place neighbors close to each other
+    i32 const periods[3] = {0, 0, 0};
+    MPI_Comm cart_comm;
+    MPI_Cart_create(comm, 3, nbs, periods, 1, &cart_comm);
+    i32 rank;
+    MPI_Comm_rank(cart_comm, &rank);
 
     // Compute neighbor nodes IDs
-    i32 const id_left = (rank_x > 0) ? (i32)rank - 1 : -1;
-    i32 const id_right = (rank_x < nb_x - 1) ? (i32)rank + 1 : -1;
-    i32 const id_top = (rank_y > 0) ? (i32)(rank - nb_x) : -1;
-    i32 const id_bottom = (rank_y < nb_y - 1) ? (i32)(rank + nb_x) : -1;
-    i32 const id_front = (rank_z > 0) ? (i32)(rank - (comm_size / nb_z)) : -1;
-    i32 const id_back = (rank_z < nb_z - 1) ? (i32)(rank + (comm_size / nb_z)) : -1;
-
-    return (comm_handler_t){
-        .nb_x = nb_x,
-        .nb_y = nb_y,
-        .nb_z = nb_z,
-        .coord_x = coord_x,
-        .coord_y = coord_y,
-        .coord_z = coord_z,
-        .loc_dim_x = loc_dim_x,
-        .loc_dim_y = loc_dim_y,
-        .loc_dim_z = loc_dim_z,
-        .id_left = id_left,
-        .id_right = id_right,
-        .id_top = id_top,
-        .id_bottom = id_bottom,
-        .id_back = id_back,
-        .id_front = id_front,
+    i32 left, right, top, bottom, front, back;
+    MPI_Cart_shift(cart_comm, 0, 1, &left, &right);
+    MPI_Cart_shift(cart_comm, 1, 1, &top, &bottom);
+    MPI_Cart_shift(cart_comm, 2, 1, &front, &back);
+
+    comm_handler_t self = {
+        .comm = cart_comm,
+        .rank = rank,
+        .exchange = exchange,
+        .dim_x = dim_x,
+        .dim_y = dim_y,
+        .dim_z = dim_z,
+        .min_dim = ghost,
+        .nb_x = (u32)nbs[0],
+        .nb_y = (u32)nbs[1],
+        .nb_z = (u32)nbs[2],
+        .id_left = neighbor_id(left),
+        .id_right = neighbor_id(right),
+        .id_top = neighbor_id(top),
+        .id_bottom = neighbor_id(bottom),
+        .id_back = neighbor_id(back),
+        .id_front = neighbor_id(front),
+        .node_comm = MPI_COMM_NULL,
+        .flags_win = MPI_WIN_NULL,
     };
+
+    // Setup size and position
+    usz* starts[3];
+    split_axes(&self, weight, starts);
+    set_local_mesh(&self, starts);
+    for (usz a = 0; a < 3; ++a) {
+        free(starts[a]);
+    }
+    if (COMM_EXCHANGE_SHARED == exchange) {
+        setup_node(&self);
+    }
+    return self;
 }
 
 void comm_handler_print(comm_handler_t const* self) {
-    i32 rank;
-    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     static char bt[MAXLEN];
     static char bb[MAXLEN];
     static char bl[MAXLEN];
@@ -97,12 +317,16 @@ void comm_handler_print(comm_handler_t const* self) {
         stderr,
         "****************************************\n"
         "RANK %d:\n"
-        "  COORDS:     %u,%u,%u\n"
+        "  SPLIT:      %ux%ux%u\n"
+        "  COORDS:     %zu,%zu,%zu\n"
         "  LOCAL DIMS: %zu,%zu,%zu\n"
         "     %2s  %2s\n"
         "  %2s  \x1b[1m*\x1b[0m  %2s\n"
         "  %2s %2s\n",
-        rank,
+        self->rank,
+        self->nb_x,
+        self->nb_y,
+        self->nb_z,
         self->coord_x,
         self->coord_y,
         self->coord_z,
@@ -118,127 +342,596 @@ void comm_handler_print(comm_handler_t const* self) {
     );
 }
 
-static i32 MPI_Syncall_callback(MPI_Comm comm) {
-    return (i32)__builtin_sync_proc(comm);
+bool comm_handler_has_neighbors(comm_handler_t const* self) {
+    return self->id_left >= 0 || self->id_right >= 0 || self->id_top >= 0 ||
+           self->id_bottom >= 0 || self->id_back >= 0 || self->id_front >= 0;
 }
-static MPI_Syncfunc_t* MPI_Syncall = MPI_Syncall_callback;
 
-static void ghost_exchange_left_right(comm_handler_t const* self, mesh_t* mesh, comm_kind_t comm_kind, i32 target, usz x_start) {
-    if (target < 0) return;
+/// Builds the datatype of a `nb_x * nb_y * nb_z` block of the cells of `mesh`.
+static MPI_Datatype block_datatype(mesh_t const* mesh, usz nb_x, usz nb_y, usz nb_z) {
+    MPI_Datatype row;
+    MPI_Type_contiguous((i32)nb_z, MPI_DOUBLE, &row);
+    MPI_Datatype plane;
+    MPI_Type_create_hvector(
+        (i32)nb_y, 1, (MPI_Aint)(mesh->stride_y * sizeof(f64)), row, &plane
+    );
+    MPI_Datatype block;
+    MPI_Type_create_hvector(
+        (i32)nb_x, 1, (MPI_Aint)(mesh->stride_x * sizeof(f64)), plane, &block
+    );
+    MPI_Type_commit(&block);
+    MPI_Type_free(&plane);
+    MPI_Type_free(&row);
+    return block;
+}
 
-    usz x_end = min(mesh->dim_x, x_start + BLOCK_SIZE_I);
-    MPI_Request request;
-    MPI_Status status;
+/// Returns the shared-memory window holding `mesh`, NULL if none.
+static comm_window_t const* window_of(comm_handler_t const* self, mesh_t const* mesh) {
+    for (usz w = 0; w < self->nb_windows; ++w) {
+        if (self->windows[w].values == mesh->values) {
+            return &self->windows[w];
+        }
+    }
+    return NULL;
+}
 
-    #pragma omp parallel for collapse(3)
-    for (usz bi = x_start; bi < x_end; bi++) {
-        for (usz bj = 0; bj < mesh->dim_y; bj++) {
-            for (usz bk = 0; bk < mesh->dim_z; bk++) {
-                if (comm_kind == COMM_KIND_SEND_OP) {
-                    MPI_Isend(&mesh->cells[bi][bj][bk].value, 1, MPI_DOUBLE, target, 0, MPI_COMM_WORLD, &request);
-                    MPI_Wait(&request, &status);
-                } else if (comm_kind == COMM_KIND_RECV_OP) {
-                    MPI_Irecv(&mesh->cells[bi][bj][bk].value, 1, MPI_DOUBLE, target, 0, MPI_COMM_WORLD, &request);
-                    MPI_Wait(&request, &status);
-                }
-            }
+/// Sets up the exchange of the two faces of `mesh` orthogonal to `axis` (0 for X, 1 for Y, 2 for
+/// Z). Faces of neighbors on the node are copied from their meshes if `mesh` is in the shared
+/// `window`.
+static void halo_setup_axis(
+    comm_handler_t const* self,
+    comm_halo_t* halo,
+    mesh_t* mesh,
+    comm_window_t const* window,
+    usz axis
+) {
+    usz const ghost = mesh->ghost;
+    usz const dims[3] = {mesh->dim_x, mesh->dim_y, mesh->dim_z};
+    usz const core[3] = {dims[0] - 2 * ghost, dims[1] - 2 * ghost, dims[2] - 2 * ghost};
+    i32 ids[COMM_NB_FACES];
+    face_neighbors(self, ids);
+    // Messages travelling towards the low side of the axis are tagged `2 * axis`, those
+    // travelling towards the high side `2 * axis + 1`
+    i32 const tag_down = (i32)(2 * axis);
+    i32 const tag_up = (i32)(2 * axis + 1);
+
+    // Starts (along `axis`) of the core cells sent and of the ghost cells received on each side
+    struct {
+        usz send;
+        usz recv;
+        i32 send_tag;
+        i32 recv_tag;
+    } const sides[2] = {
+        {ghost, 0, tag_down, tag_up},
+        {dims[axis] - 2 * ghost, dims[axis] - ghost, tag_up, tag_down},
+    };
+    for (usz s = 0; s < 2; ++s) {
+        usz const n = 2 * axis + s;
+        i32 const neighbor = ids[n];
+        if (neighbor >= 0) {
+            i32 face_size;
+            MPI_Type_size(halo->faces[axis], &face_size);
+            halo->sent_bytes += (u64)face_size;
+            halo->nb_sent += 1;
+        }
+        // Deep faces span the ghost cells of the axes exchanged before (see `halo_of`)
+        usz send[3] = {ghost, ghost, ghost};
+        for (usz a = 0; a < axis && halo->deep; ++a) {
+            send[a] = 0;
         }
+        usz recv[3] = {send[0], send[1], send[2]};
+        send[axis] = sides[s].send;
+        recv[axis] = sides[s].recv;
+        f64* send_cells = idx(mesh, send[0], send[1], send[2]);
+        f64* recv_cells = idx(mesh, recv[0], recv[1], recv[2]);
+
+        if (COMM_EXCHANGE_NEIGHBOR == self->exchange) {
+            // Faces without neighbor are skipped by the collective
+            halo->counts[n] = 1;
+            halo->types[n] = halo->faces[axis];
+            MPI_Get_address(send_cells, &halo->send_displs[n]);
+            MPI_Get_address(recv_cells, &halo->recv_displs[n]);
+            continue;
+        }
+        if (neighbor < 0) {
+            continue;
+        }
+
+        if (NULL != window && NULL != window->peers[n].values) {
+            // The ghost cells are the cells the neighbor sends on the opposite side
+            mesh_t const* peer = &window->peers[n];
+            usz const peer_dims[3] = {peer->dim_x, peer->dim_y, peer->dim_z};
+            usz src[3] = {ghost, ghost, ghost};
+            src[axis] = (0 == s) ? peer_dims[axis] - 2 * ghost : ghost;
+            usz extents[3] = {core[0], core[1], core[2]};
+            extents[axis] = ghost;
+            halo->copies[halo->nb_copies++] = (comm_copy_t){
+                .src = peer->values + mesh_offset(peer, src[0], src[1], src[2]),
+                .dst = recv_cells,
+                .nb_x = extents[0],
+                .nb_y = extents[1],
+                .nb_z = extents[2],
+                .src_stride_x = peer->stride_x,
+                .src_stride_y = peer->stride_y,
+                .dst_stride_x = mesh->stride_x,
+                .dst_stride_y = mesh->stride_y,
+                .flags = self->peer_flags[n],
+            };
+            continue;
+        }
+        MPI_Send_init(
+            send_cells,
+            1,
+            halo->faces[axis],
+            neighbor,
+            sides[s].send_tag,
+            self->comm,
+            &halo->requests[halo->nb_requests++]
+        );
+        MPI_Recv_init(
+            recv_cells,
+            1,
+            halo->faces[axis],
+            neighbor,
+            sides[s].recv_tag,
+            self->comm,
+            &halo->requests[halo->nb_requests++]
+        );
     }
+    halo->axis_requests[axis] = halo->nb_requests;
 }
 
+/// Returns the exchange of `mesh`, setting it up if it is the first one.
+static comm_halo_t* halo_of(comm_handler_t* self, mesh_t* mesh) {
+    for (usz h = 0; h < self->nb_halos; ++h) {
+        if (self->halos[h].values == mesh->values) {
+            return &self->halos[h];
+        }
+    }
+    if (COMM_MAX_HALOS == self->nb_halos) {
+        error("cannot exchange the ghost cells of more than %d meshes", COMM_MAX_HALOS);
+    }
+
+    // The stencil is a star: only the faces are read, not the edges and corners of the ghost region.
+    // Iterations computed on deep ghost layers do read their edges and corners: axes are then
+    // exchanged one after the other, faces spanning the ghost cells received along the previous
+    // ones, which forwards the cells of the diagonal neighbors
+    usz const ghost = mesh->ghost;
+    bool const deep = ghost > mesh->order;
+    usz const core_x = mesh->dim_x - 2 * ghost;
+    usz const core_y = mesh->dim_y - 2 * ghost;
+    usz const core_z = mesh->dim_z - 2 * ghost;
+    comm_halo_t* halo = &self->halos[self->nb_halos++];
+    *halo = (comm_halo_t){
+        .values = mesh->values,
+        .deep = deep,
+        .faces = {
+            block_datatype(mesh, ghost, core_y, core_z),
+            block_datatype(mesh, deep ? mesh->dim_x : core_x, ghost, core_z),
+            block_datatype(mesh, deep ? mesh->dim_x : core_x, deep ? mesh->dim_y : core_y, ghost),
+        },
+        .collective = MPI_REQUEST_NULL,
+    };
+    // Faces of deep ghost layers are not copied from the neighbors on the node, whose cells
+    // received along the previous axes would not be ready yet
+    comm_window_t const* window = deep ? NULL : window_of(self, mesh);
+    for (usz axis = 0; axis < 3; ++axis) {
+        halo_setup_axis(self, halo, mesh, window, axis);
+    }
+    return halo;
+}
 
+/// Returns `ptr` rounded up to the alignment of meshes.
+static void* align_up(void* ptr) {
+    return (void*)(((uintptr_t)ptr + MESH_ALIGNMENT - 1) / MESH_ALIGNMENT * MESH_ALIGNMENT);
+}
 
-static void ghost_exchange_top_bottom(comm_handler_t const* self, mesh_t* mesh, comm_kind_t comm_kind, i32 target, usz y_start) {
-    if (target < 0) return;
+mesh_t comm_handler_mesh_new(
+    comm_handler_t* self,
+    usz dim_x,
+    usz dim_y,
+    usz dim_z,
+    usz order,
+    usz depth,
+    mesh_kind_t kind,
+    mesh_alloc_t alloc
+) {
+    if (COMM_EXCHANGE_SHARED != self->exchange) {
+        return mesh_new(dim_x, dim_y, dim_z, order, depth, kind, alloc);
+    }
+    // Slots of the dropped meshes are reused
+    comm_window_t* window = NULL;
+    for (usz w = 0; w < self->nb_windows && NULL == window; ++w) {
+        window = (NULL == self->windows[w].values) ? &self->windows[w] : NULL;
+    }
+    if (NULL == window) {
+        if (COMM_MAX_HALOS == self->nb_windows) {
+            error("cannot allocate more than %d meshes in shared memory", COMM_MAX_HALOS);
+        }
+        window = &self->windows[self->nb_windows++];
+    }
 
-    usz y_end = min(mesh->dim_y, y_start + BLOCK_SIZE_J);
-    MPI_Request request;
-    MPI_Status status;
+    // Segments of the ranks are kept apart, so that pages are placed by their first touch
+    mesh_t mesh = mesh_layout(dim_x, dim_y, dim_z, order, depth, kind);
+    MPI_Info info;
+    MPI_Info_create(&info);
+    MPI_Info_set(info, "alloc_shared_noncontig", "true");
+    void* base;
+    MPI_Win_allocate_shared(
+        (MPI_Aint)(mesh.size + MESH_ALIGNMENT), 1, info, self->node_comm, &base, &window->win
+    );
+    MPI_Info_free(&info);
+    mesh.values = align_up(base);
+    window->values = mesh.values;
+
+    // Layouts of the meshes of the node, those of the neighbors are mapped
+    i32 node_size;
+    MPI_Comm_size(self->node_comm, &node_size);
+    mesh_t* layouts = malloc((usz)node_size * sizeof(mesh_t));
+    MPI_Allgather(
+        &mesh, sizeof(mesh_t), MPI_BYTE, layouts, sizeof(mesh_t), MPI_BYTE, self->node_comm
+    );
+    for (usz f = 0; f < COMM_NB_FACES; ++f) {
+        window->peers[f] = (mesh_t){0};
+        if (self->node_ids[f] < 0) {
+            continue;
+        }
+        MPI_Aint size;
+        i32 disp_unit;
+        void* peer_base;
+        MPI_Win_shared_query(window->win, self->node_ids[f], &size, &disp_unit, &peer_base);
+        window->peers[f] = layouts[self->node_ids[f]];
+        window->peers[f].values = align_up(peer_base);
+    }
+    free(layouts);
+    return mesh;
+}
 
-    #pragma omp parallel for collapse(3)
-    for (usz bj = y_start; bj < y_end; bj++) {
-        for (usz bi = 0; bi < mesh->dim_x; bi++) {
-            for (usz bk = 0; bk < mesh->dim_z; bk++) {
-                if (comm_kind == COMM_KIND_SEND_OP) {
-                    MPI_Isend(&mesh->cells[bi][bj][bk].value, 1, MPI_DOUBLE, target, 0, MPI_COMM_WORLD, &request);
-                    MPI_Wait(&request, &status);
-                } else if (comm_kind == COMM_KIND_RECV_OP) {
-                    MPI_Irecv(&mesh->cells[bi][bj][bk].value, 1, MPI_DOUBLE, target, 0, MPI_COMM_WORLD, &request);
-                    MPI_Wait(&request, &status);
-                }
-            }
+void comm_handler_mesh_drop(comm_handler_t* self, mesh_t* mesh) {
+    for (usz w = 0; w < self->nb_windows; ++w) {
+        if (NULL != mesh->values && self->windows[w].values == mesh->values) {
+            MPI_Win_free(&self->windows[w].win);
+            self->windows[w].values = NULL;
+            mesh->values = NULL;
+            return;
         }
     }
+    mesh_drop(mesh);
 }
 
+/// Body of the progress thread: polls MPI while exchanges are in flight.
+static void* progress_loop(void* arg) {
+    comm_progress_t* progress = arg;
+    if (progress->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(progress->cpu, &set);
+        if (0 != sched_setaffinity(0, sizeof(set), &set)) {
+            warn("failed to pin progress thread to CPU %d: %s", progress->cpu, strerror(errno));
+        }
+    }
 
-static void ghost_exchange_front_back(comm_handler_t const* self, mesh_t* mesh, comm_kind_t comm_kind, i32 target, usz z_start) {
-    if (target < 0) return;
+    struct timespec const idle = {.tv_sec = 0, .tv_nsec = PROGRESS_IDLE_NS};
+    while (!__atomic_load_n(&progress->stop, __ATOMIC_ACQUIRE)) {
+        if (__atomic_load_n(&progress->in_flight, __ATOMIC_ACQUIRE) > 0) {
+            // Nothing is ever sent on this communicator, probing it only runs the progress engine
+            i32 flag;
+            MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, progress->comm, &flag, MPI_STATUS_IGNORE);
+        } else {
+            nanosleep(&idle, NULL);
+        }
+    }
+    return NULL;
+}
 
-    usz z_end = min(mesh->dim_z, z_start + BLOCK_SIZE_K);
-    MPI_Request request;
-    MPI_Status status;
+void comm_handler_progress_start(comm_handler_t* self, i32 cpu) {
+    comm_progress_t* progress = &self->progress;
+    MPI_Comm_dup(self->comm, &progress->comm);
+    progress->cpu = cpu;
+    progress->in_flight = 0;
+    progress->stop = false;
+    i32 const rc = pthread_create(&progress->thread, NULL, progress_loop, progress);
+    if (0 != rc) {
+        error("failed to start communication progress thread: %s", strerror(rc));
+    }
+    progress->running = true;
+}
 
-    #pragma omp parallel for collapse(3)
-    for (usz bk = z_start; bk < z_end; bk++) {
-        for (usz bi = 0; bi < mesh->dim_x; bi++) {
-            for (usz bj = 0; bj < mesh->dim_y; bj++) {
-                if (comm_kind == COMM_KIND_SEND_OP) {
-                    MPI_Isend(&mesh->cells[bi][bj][bk].value, 1, MPI_DOUBLE, target, 0, MPI_COMM_WORLD, &request);
-                    MPI_Wait(&request, &status);
-                } else if (comm_kind == COMM_KIND_RECV_OP) {
-                    MPI_Irecv(&mesh->cells[bi][bj][bk].value, 1, MPI_DOUBLE, target, 0, MPI_COMM_WORLD, &request);
-                    MPI_Wait(&request, &status);
-                }
-            }
+/// Frees the persistent requests and the datatypes of the exchanges set up so far.
+static void release_halos(comm_handler_t* self) {
+    for (usz h = 0; h < self->nb_halos; ++h) {
+        comm_halo_t* halo = &self->halos[h];
+        for (i32 r = 0; r < halo->nb_requests; ++r) {
+            MPI_Request_free(&halo->requests[r]);
+        }
+        for (usz f = 0; f < 3; ++f) {
+            MPI_Type_free(&halo->faces[f]);
         }
     }
+    self->nb_halos = 0;
 }
 
-void comm_handler_ghost_exchange(comm_handler_t const* self, mesh_t* mesh) {
-    // Ensure all processes reach this point before proceeding
-    MPI_Barrier(MPI_COMM_WORLD);
+void comm_handler_drop(comm_handler_t* self) {
+    if (self->progress.running) {
+        __atomic_store_n(&self->progress.stop, true, __ATOMIC_RELEASE);
+        pthread_join(self->progress.thread, NULL);
+        MPI_Comm_free(&self->progress.comm);
+        self->progress.running = false;
+    }
+    release_halos(self);
+    if (MPI_WIN_NULL != self->flags_win) {
+        MPI_Win_free(&self->flags_win);
+    }
+    if (MPI_COMM_NULL != self->node_comm) {
+        MPI_Comm_free(&self->node_comm);
+    }
+    MPI_Comm_free(&self->comm);
+}
 
-    // Left to right phase
-    ghost_exchange_left_right(self, mesh, COMM_KIND_SEND_OP, self->id_right, mesh->dim_x - 2 * BLOCK_SIZE_I);
-    ghost_exchange_left_right(self, mesh, COMM_KIND_RECV_OP, self->id_left, 0);
+/// Intersects the boxes of cells starting at `lo_a` and `lo_b` with extents `len_a` and `len_b`
+/// along each axis. Returns false if it is empty.
+static bool intersect_boxes(
+    usz const lo_a[static 3],
+    usz const len_a[static 3],
+    usz const lo_b[static 3],
+    usz const len_b[static 3],
+    usz lo[static 3],
+    usz len[static 3]
+) {
+    for (usz a = 0; a < 3; ++a) {
+        lo[a] = (lo_a[a] > lo_b[a]) ? lo_a[a] : lo_b[a];
+        usz const hi_a = lo_a[a] + len_a[a];
+        usz const hi_b = lo_b[a] + len_b[a];
+        usz const hi = (hi_a < hi_b) ? hi_a : hi_b;
+        if (hi <= lo[a]) {
+            return false;
+        }
+        len[a] = hi - lo[a];
+    }
+    return true;
+}
 
-    // Ensure all processes have completed left to right communication
-    MPI_Barrier(MPI_COMM_WORLD);
+mesh_t comm_handler_rebalance(
+    comm_handler_t* self, f64 weight, mesh_t const* mesh, mesh_alloc_t alloc
+) {
+    // Persistent exchanges refer to the meshes of the previous split
+    release_halos(self);
 
-    // Right to left phase
-    ghost_exchange_left_right(self, mesh, COMM_KIND_SEND_OP, self->id_left, BLOCK_SIZE_I);
-    ghost_exchange_left_right(self, mesh, COMM_KIND_RECV_OP, self->id_right, mesh->dim_x - BLOCK_SIZE_I);
+    i32 comm_size;
+    MPI_Comm_size(self->comm, &comm_size);
+    usz const prev_box[6] = {
+        self->coord_x,
+        self->coord_y,
+        self->coord_z,
+        self->loc_dim_x,
+        self->loc_dim_y,
+        self->loc_dim_z,
+    };
+    usz* prev_boxes = malloc(6 * (usz)comm_size * sizeof(usz));
+    MPI_Allgather(
+        prev_box, 6 * sizeof(usz), MPI_BYTE, prev_boxes, 6 * sizeof(usz), MPI_BYTE, self->comm
+    );
 
-    // Ensure all processes have completed right to left communication
-    MPI_Barrier(MPI_COMM_WORLD);
+    usz* starts[3];
+    split_axes(self, weight, starts);
+    set_local_mesh(self, starts);
+    usz const box[6] = {
+        self->coord_x,
+        self->coord_y,
+        self->coord_z,
+        self->loc_dim_x,
+        self->loc_dim_y,
+        self->loc_dim_z,
+    };
+    mesh_t moved = mesh_new(
+        self->loc_dim_x,
+        self->loc_dim_y,
+        self->loc_dim_z,
+        mesh->order,
+        mesh->ghost / mesh->order,
+        mesh->kind,
+        alloc
+    );
 
-    // Top to bottom phase
-    ghost_exchange_top_bottom(self, mesh, COMM_KIND_SEND_OP, self->id_top, mesh->dim_y - 2 * BLOCK_SIZE_J);
-    ghost_exchange_top_bottom(self, mesh, COMM_KIND_RECV_OP, self->id_bottom, 0);
+    // Cells of the previous local mesh go to the ranks whose new local mesh overlaps it, and
+    // conversely
+    usz const ghost = mesh->ghost;
+    i32 nb_requests = 0;
+    MPI_Request* requests = malloc(2 * (usz)comm_size * sizeof(MPI_Request));
+    for (i32 r = 0; r < comm_size; ++r) {
+        i32 coords[3];
+        MPI_Cart_coords(self->comm, r, 3, coords);
+        usz const lo_r[3] = {starts[0][coords[0]], starts[1][coords[1]], starts[2][coords[2]]};
+        usz const len_r[3] = {
+            starts[0][coords[0] + 1] - lo_r[0],
+            starts[1][coords[1] + 1] - lo_r[1],
+            starts[2][coords[2] + 1] - lo_r[2],
+        };
+        usz lo[3];
+        usz len[3];
+        if (intersect_boxes(prev_box, prev_box + 3, lo_r, len_r, lo, len)) {
+            MPI_Datatype block = block_datatype(mesh, len[0], len[1], len[2]);
+            MPI_Isend(
+                mesh->values + mesh_offset(
+                                   mesh,
+                                   lo[0] - prev_box[0] + ghost,
+                                   lo[1] - prev_box[1] + ghost,
+                                   lo[2] - prev_box[2] + ghost
+                               ),
+                1,
+                block,
+                r,
+                0,
+                self->comm,
+                &requests[nb_requests++]
+            );
+            MPI_Type_free(&block);
+        }
+        usz const* prev_r = prev_boxes + 6 * r;
+        if (intersect_boxes(prev_r, prev_r + 3, box, box + 3, lo, len)) {
+            MPI_Datatype block = block_datatype(&moved, len[0], len[1], len[2]);
+            MPI_Irecv(
+                idx(&moved, lo[0] - box[0] + ghost, lo[1] - box[1] + ghost, lo[2] - box[2] + ghost),
+                1,
+                block,
+                r,
+                0,
+                self->comm,
+                &requests[nb_requests++]
+            );
+            MPI_Type_free(&block);
+        }
+    }
+    MPI_Waitall(nb_requests, requests, MPI_STATUSES_IGNORE);
 
-    // Ensure all processes have completed top to bottom communication
-    MPI_Barrier(MPI_COMM_WORLD);
+    free(requests);
+    for (usz a = 0; a < 3; ++a) {
+        free(starts[a]);
+    }
+    free(prev_boxes);
+    return moved;
+}
+
+/// Exchanges the deep ghost layers of `mesh` one axis after the other.
+static void ghost_exchange_deep(comm_handler_t* self, comm_halo_t* halo) {
+    i32 first = 0;
+    for (usz axis = 0; axis < 3; ++axis) {
+        if (COMM_EXCHANGE_NEIGHBOR == self->exchange) {
+            i32 counts[COMM_NB_FACES] = {0};
+            counts[2 * axis] = halo->counts[2 * axis];
+            counts[2 * axis + 1] = halo->counts[2 * axis + 1];
+            MPI_Neighbor_alltoallw(
+                MPI_BOTTOM,
+                counts,
+                halo->send_displs,
+                halo->types,
+                MPI_BOTTOM,
+                counts,
+                halo->recv_displs,
+                halo->types,
+                self->comm
+            );
+            continue;
+        }
+        i32 const last = halo->axis_requests[axis];
+        MPI_Startall(last - first, halo->requests + first);
+        MPI_Waitall(last - first, halo->requests + first, MPI_STATUSES_IGNORE);
+        first = last;
+    }
+}
 
-    // Bottom to top phase
-    ghost_exchange_top_bottom(self, mesh, COMM_KIND_SEND_OP, self->id_bottom, BLOCK_SIZE_J);
-    ghost_exchange_top_bottom(self, mesh, COMM_KIND_RECV_OP, self->id_top, mesh->dim_y - BLOCK_SIZE_J);
+/// Waits for the flag of a neighbor on the node to reach `epoch`.
+static void wait_flag(u64 const* flag, u64 epoch) {
+    while (__atomic_load_n(flag, __ATOMIC_ACQUIRE) < epoch) {
+        sched_yield();
+    }
+}
 
-    // Ensure all processes have completed bottom to top communication
-    MPI_Barrier(MPI_COMM_WORLD);
+/// Copies ghost cells from the mesh of a neighbor on the node.
+static void copy_face(comm_copy_t const* copy) {
+    for (usz i = 0; i < copy->nb_x; ++i) {
+        for (usz j = 0; j < copy->nb_y; ++j) {
+            memcpy(
+                copy->dst + i * copy->dst_stride_x + j * copy->dst_stride_y,
+                copy->src + i * copy->src_stride_x + j * copy->src_stride_y,
+                copy->nb_z * sizeof(f64)
+            );
+        }
+    }
+}
 
-    // Front to back phase
-    ghost_exchange_front_back(self, mesh, COMM_KIND_SEND_OP, self->id_back, mesh->dim_z - 2 * BLOCK_SIZE_K);
-    ghost_exchange_front_back(self, mesh, COMM_KIND_RECV_OP, self->id_front, 0);
+/// Posts the exchange of the ghost cells of `halo`.
+static void ghost_start(comm_handler_t* self, comm_halo_t* halo) {
+    if (self->progress.running) {
+        __atomic_add_fetch(&self->progress.in_flight, 1, __ATOMIC_RELEASE);
+    }
+    switch (self->exchange) {
+        case COMM_EXCHANGE_SHARED:
+            // The faces of the local mesh can be copied by the neighbors on the node
+            self->epoch += 1;
+            if (halo->nb_copies > 0) {
+                __atomic_store_n(&self->flags[0], self->epoch, __ATOMIC_RELEASE);
+            }
+            // fall through
+        case COMM_EXCHANGE_P2P:
+            MPI_Startall(halo->nb_requests, halo->requests);
+            break;
+        case COMM_EXCHANGE_NEIGHBOR:
+            MPI_Ineighbor_alltoallw(
+                MPI_BOTTOM,
+                halo->counts,
+                halo->send_displs,
+                halo->types,
+                MPI_BOTTOM,
+                halo->counts,
+                halo->recv_displs,
+                halo->types,
+                self->comm,
+                &halo->collective
+            );
+            break;
+        default:
+            __builtin_unreachable();
+    }
+}
 
-    // Ensure all processes have completed front to back communication
-    MPI_Barrier(MPI_COMM_WORLD);
+/// Completes the exchange of the ghost cells of `halo`.
+static void ghost_finish(comm_handler_t* self, comm_halo_t* halo) {
+    switch (self->exchange) {
+        case COMM_EXCHANGE_P2P:
+            MPI_Waitall(halo->nb_requests, halo->requests, MPI_STATUSES_IGNORE);
+            break;
+        case COMM_EXCHANGE_NEIGHBOR:
+            MPI_Wait(&halo->collective, MPI_STATUS_IGNORE);
+            break;
+        case COMM_EXCHANGE_SHARED:
+            // Copy the faces of the neighbors on the node once they are ready, then wait for them
+            // to have copied ours so that the local mesh can be written again
+            for (usz c = 0; c < halo->nb_copies; ++c) {
+                wait_flag(&halo->copies[c].flags[0], self->epoch);
+                copy_face(&halo->copies[c]);
+            }
+            if (halo->nb_copies > 0) {
+                __atomic_store_n(&self->flags[1], self->epoch, __ATOMIC_RELEASE);
+            }
+            MPI_Waitall(halo->nb_requests, halo->requests, MPI_STATUSES_IGNORE);
+            for (usz c = 0; c < halo->nb_copies; ++c) {
+                wait_flag(&halo->copies[c].flags[1], self->epoch);
+            }
+            break;
+        default:
+            __builtin_unreachable();
+    }
+    if (self->progress.running) {
+        __atomic_sub_fetch(&self->progress.in_flight, 1, __ATOMIC_RELEASE);
+    }
+}
 
-    // Back to front phase
-    ghost_exchange_front_back(self, mesh, COMM_KIND_SEND_OP, self->id_front, BLOCK_SIZE_K);
-    ghost_exchange_front_back(self, mesh, COMM_KIND_RECV_OP, self->id_back, mesh->dim_z - BLOCK_SIZE_K);
+// An exchange is timed as a single call of the exchange phase, even when it is posted and completed
+// separately
+void comm_handler_ghost_exchange(comm_handler_t* self, mesh_t* mesh) {
+    comm_halo_t* halo = halo_of(self, mesh);
+    INSTRUMENT_SCOPE(INSTRUMENT_PHASE_EXCHANGE);
+    INSTRUMENT_COUNT(INSTRUMENT_PHASE_EXCHANGE, INSTRUMENT_COUNTER_BYTES, halo->sent_bytes);
+    INSTRUMENT_COUNT(INSTRUMENT_PHASE_EXCHANGE, INSTRUMENT_COUNTER_MESSAGES, halo->nb_sent);
+    if (halo->deep) {
+        ghost_exchange_deep(self, halo);
+        return;
+    }
+    ghost_start(self, halo);
+    ghost_finish(self, halo);
+}
 
-    // Ensure all processes are synchronized before any further execution
-    MPI_Barrier(MPI_COMM_WORLD);
+void comm_handler_ghost_start(comm_handler_t* self, mesh_t* mesh) {
+    comm_halo_t* halo = halo_of(self, mesh);
+    assert(!halo->deep);
+    INSTRUMENT_SCOPE_PART(INSTRUMENT_PHASE_EXCHANGE);
+    INSTRUMENT_COUNT(INSTRUMENT_PHASE_EXCHANGE, INSTRUMENT_COUNTER_BYTES, halo->sent_bytes);
+    INSTRUMENT_COUNT(INSTRUMENT_PHASE_EXCHANGE, INSTRUMENT_COUNTER_MESSAGES, halo->nb_sent);
+    ghost_start(self, halo);
 }
 
+void comm_handler_ghost_finish(comm_handler_t* self, mesh_t* mesh) {
+    INSTRUMENT_SCOPE(INSTRUMENT_PHASE_EXCHANGE);
+    ghost_finish(self, halo_of(self, mesh));
+}
@@ -1,6 +1,7 @@
 #define _GNU_SOURCE
 
 #include "stencil/config.h"
+#include "stencil/instrument.h"
 
 #include "logging.h"
 
@@ -13,53 +14,317 @@ static inline config_t config_default() {
         .dim_y = 100,
         .dim_z = 100,
         .niter = 5,
+        .order = STENCIL_MAX_ORDER,
+        .alloc =
+            {
+                .pages = MESH_PAGES_DEFAULT,
+                .numa = MESH_NUMA_LOCAL,
+            },
+        .buffering = SOLVE_BUFFERING_SWAP,
+        .product = false,
+        .simd = KERNEL_ISA_AUTO,
+        .time_block = 1,
+        .overlap = true,
+        .exchange = COMM_EXCHANGE_P2P,
+        .halo_depth = 1,
+        .balance = COMM_BALANCE_EVEN,
+        .weights = "top-stencil.weights",
+        .rebalance = 0,
+        .metrics_batch = 0,
+        .snapshot = 0,
+        .snapshot_path = "top-stencil.snap",
+        .snapshot_step = 1,
+        .snapshot_region = {{0, 0, 0}, {0, 0, 0}},
+        .checkpoint = 0,
+        .checkpoint_path = "top-stencil.ckpt",
+        .restart = false,
+        .instrument = "",
+        .perf = false,
+        .trace = "",
+        .trace_events = INSTRUMENT_TRACE_EVENTS,
+        .progress = false,
+        .sweep = SOLVE_SWEEP_BLOCKED,
+        .tile = SOLVE_TILE_DEFAULT,
+        .autotune = false,
+        .tune_cache = "top-stencil.tune",
+        .threads = 0,
+        .affinity = TEAM_AFFINITY_NONE,
     };
 }
 
+static bool parse_usz(char const* val, usz* out) {
+    char* end;
+    unsigned long long n = strtoull(val, &end, 10);
+    if (end == val || '\0' != *end) {
+        return false;
+    }
+    *out = (usz)n;
+    return true;
+}
+
+static bool parse_bool(char const* val, bool* out) {
+    if (strcmp("0", val) == 0 || strcmp("false", val) == 0) {
+        *out = false;
+    } else if (strcmp("1", val) == 0 || strcmp("true", val) == 0) {
+        *out = true;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool parse_pages(char const* val, mesh_pages_t* out) {
+    if (strcmp("default", val) == 0) {
+        *out = MESH_PAGES_DEFAULT;
+    } else if (strcmp("thp", val) == 0) {
+        *out = MESH_PAGES_TRANSPARENT;
+    } else if (strcmp("hugetlb", val) == 0) {
+        *out = MESH_PAGES_HUGETLB;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool parse_numa(char const* val, mesh_numa_t* out) {
+    if (strcmp("local", val) == 0) {
+        *out = MESH_NUMA_LOCAL;
+    } else if (strcmp("interleave", val) == 0) {
+        *out = MESH_NUMA_INTERLEAVE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool parse_buffering(char const* val, solve_buffering_t* out) {
+    if (strcmp("swap", val) == 0) {
+        *out = SOLVE_BUFFERING_SWAP;
+    } else if (strcmp("copy", val) == 0) {
+        *out = SOLVE_BUFFERING_COPY;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool parse_simd(char const* val, kernel_isa_t* out) {
+    if (strcmp("auto", val) == 0) {
+        *out = KERNEL_ISA_AUTO;
+    } else if (strcmp("scalar", val) == 0) {
+        *out = KERNEL_ISA_SCALAR;
+    } else if (strcmp("sse2", val) == 0) {
+        *out = KERNEL_ISA_SSE2;
+    } else if (strcmp("avx2", val) == 0) {
+        *out = KERNEL_ISA_AVX2;
+    } else if (strcmp("avx512", val) == 0) {
+        *out = KERNEL_ISA_AVX512;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool parse_sweep(char const* val, solve_sweep_t* out) {
+    if (strcmp("blocked", val) == 0) {
+        *out = SOLVE_SWEEP_BLOCKED;
+    } else if (strcmp("streaming", val) == 0) {
+        *out = SOLVE_SWEEP_STREAMING;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool parse_exchange(char const* val, comm_exchange_t* out) {
+    if (strcmp("p2p", val) == 0) {
+        *out = COMM_EXCHANGE_P2P;
+    } else if (strcmp("neighbor", val) == 0) {
+        *out = COMM_EXCHANGE_NEIGHBOR;
+    } else if (strcmp("shared", val) == 0) {
+        *out = COMM_EXCHANGE_SHARED;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool parse_balance(char const* val, comm_balance_t* out) {
+    if (strcmp("even", val) == 0) {
+        *out = COMM_BALANCE_EVEN;
+    } else if (strcmp("calibrate", val) == 0) {
+        *out = COMM_BALANCE_CALIBRATE;
+    } else if (strcmp("file", val) == 0) {
+        *out = COMM_BALANCE_FILE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool parse_affinity(char const* val, team_affinity_t* out) {
+    if (strcmp("none", val) == 0) {
+        *out = TEAM_AFFINITY_NONE;
+    } else if (strcmp("compact", val) == 0) {
+        *out = TEAM_AFFINITY_COMPACT;
+    } else if (strcmp("spread", val) == 0) {
+        *out = TEAM_AFFINITY_SPREAD;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/// Applies the overrides from the environment.
+static void config_apply_env(config_t* self) {
+    char const* simd = getenv("STENCIL_SIMD");
+    if (NULL != simd && !parse_simd(simd, &self->simd)) {
+        warn("invalid value `%s` for environment variable STENCIL_SIMD, ignoring it", simd);
+    }
+}
+
+bool config_set(config_t* self, char const key[static 1], char const val[static 1]) {
+    bool ok;
+    if (strcmp("dim_x", key) == 0) {
+        ok = parse_usz(val, &self->dim_x);
+    } else if (strcmp("dim_y", key) == 0) {
+        ok = parse_usz(val, &self->dim_y);
+    } else if (strcmp("dim_z", key) == 0) {
+        ok = parse_usz(val, &self->dim_z);
+    } else if (strcmp("niter", key) == 0) {
+        ok = parse_usz(val, &self->niter);
+    } else if (strcmp("order", key) == 0) {
+        ok = parse_usz(val, &self->order) && kernel_has_order(self->order);
+    } else if (strcmp("pages", key) == 0) {
+        ok = parse_pages(val, &self->alloc.pages);
+    } else if (strcmp("numa", key) == 0) {
+        ok = parse_numa(val, &self->alloc.numa);
+    } else if (strcmp("buffering", key) == 0) {
+        ok = parse_buffering(val, &self->buffering);
+    } else if (strcmp("product", key) == 0) {
+        ok = parse_bool(val, &self->product);
+    } else if (strcmp("simd", key) == 0) {
+        ok = parse_simd(val, &self->simd);
+    } else if (strcmp("time_block", key) == 0) {
+        ok = parse_usz(val, &self->time_block) && self->time_block > 0;
+    } else if (strcmp("overlap", key) == 0) {
+        ok = parse_bool(val, &self->overlap);
+    } else if (strcmp("exchange", key) == 0) {
+        ok = parse_exchange(val, &self->exchange);
+    } else if (strcmp("halo_depth", key) == 0) {
+        ok = parse_usz(val, &self->halo_depth) && self->halo_depth > 0;
+    } else if (strcmp("balance", key) == 0) {
+        ok = parse_balance(val, &self->balance);
+    } else if (strcmp("weights", key) == 0) {
+        ok = strlen(val) < CONFIG_PATH_LEN;
+        if (ok) {
+            strcpy(self->weights, val);
+        }
+    } else if (strcmp("rebalance", key) == 0) {
+        ok = parse_usz(val, &self->rebalance);
+    } else if (strcmp("metrics_batch", key) == 0) {
+        ok = parse_usz(val, &self->metrics_batch);
+    } else if (strcmp("snapshot", key) == 0) {
+        ok = parse_usz(val, &self->snapshot);
+    } else if (strcmp("snapshot_path", key) == 0) {
+        ok = strlen(val) < CONFIG_PATH_LEN;
+        if (ok) {
+            strcpy(self->snapshot_path, val);
+        }
+    } else if (strcmp("snapshot_step", key) == 0) {
+        ok = parse_usz(val, &self->snapshot_step) && self->snapshot_step > 0;
+    } else if (strcmp("snapshot_region", key) == 0) {
+        ok = snapshot_region_parse(val, &self->snapshot_region);
+    } else if (strcmp("checkpoint", key) == 0) {
+        ok = parse_usz(val, &self->checkpoint);
+    } else if (strcmp("checkpoint_path", key) == 0) {
+        ok = strlen(val) < CONFIG_PATH_LEN;
+        if (ok) {
+            strcpy(self->checkpoint_path, val);
+        }
+    } else if (strcmp("restart", key) == 0) {
+        ok = parse_bool(val, &self->restart);
+    } else if (strcmp("instrument", key) == 0) {
+        ok = strlen(val) < CONFIG_PATH_LEN;
+        if (ok) {
+            strcpy(self->instrument, val);
+        }
+    } else if (strcmp("perf", key) == 0) {
+        ok = parse_bool(val, &self->perf);
+    } else if (strcmp("trace", key) == 0) {
+        ok = strlen(val) < CONFIG_PATH_LEN;
+        if (ok) {
+            strcpy(self->trace, val);
+        }
+    } else if (strcmp("trace_events", key) == 0) {
+        ok = parse_usz(val, &self->trace_events) && self->trace_events > 0;
+    } else if (strcmp("progress", key) == 0) {
+        ok = parse_bool(val, &self->progress);
+    } else if (strcmp("sweep", key) == 0) {
+        ok = parse_sweep(val, &self->sweep);
+    } else if (strcmp("tile_x", key) == 0) {
+        ok = parse_usz(val, &self->tile.x) && self->tile.x > 0;
+    } else if (strcmp("tile_y", key) == 0) {
+        ok = parse_usz(val, &self->tile.y) && self->tile.y > 0;
+    } else if (strcmp("tile_z", key) == 0) {
+        ok = parse_usz(val, &self->tile.z) && self->tile.z > 0;
+    } else if (strcmp("autotune", key) == 0) {
+        ok = parse_bool(val, &self->autotune);
+    } else if (strcmp("tune_cache", key) == 0) {
+        ok = strlen(val) < CONFIG_PATH_LEN;
+        if (ok) {
+            strcpy(self->tune_cache, val);
+        }
+    } else if (strcmp("threads", key) == 0) {
+        ok = parse_usz(val, &self->threads);
+    } else if (strcmp("affinity", key) == 0) {
+        ok = parse_affinity(val, &self->affinity);
+    } else {
+        warn("unknown configuration key `%s`", key);
+        return false;
+    }
+
+    if (!ok) {
+        warn("invalid value `%s` for configuration key `%s`", val, key);
+    }
+    return ok;
+}
+
 config_t config_parse_from_file(char const file_name[static 1]) {
     FILE* cfp = fopen(file_name, "rb");
     if (NULL == cfp) {
         warn("failed to open configuration file %s, using default", file_name);
-        return config_default();
+        config_t self = config_default();
+        config_apply_env(&self);
+        return self;
     }
 
     config_t self = config_default();
     usz MAX_LINE_LEN = 64;
     char* line_buf = malloc(MAX_LINE_LEN);
     usz line_num = 0;
-    while (0 == feof(cfp)) {
+    while (-1 != getline(&line_buf, &MAX_LINE_LEN, cfp)) {
         line_num += 1;
-        getline(&line_buf, &MAX_LINE_LEN, cfp);
-        if (NULL == line_buf) {
-            warn("failed to read line %zu in file %s, using default", line_num, file_name);
-            return config_default();
+        if ('#' == line_buf[0] || '\n' == line_buf[0]) {
+            continue;
         }
 
-        if ('#' == line_buf[0]) {
-            continue;
+        char key[32];
+        char val[CONFIG_PATH_LEN];
+        if (2 != sscanf(line_buf, "%31[^=]=%255s", key, val)) {
+            warn("failed to read line %zu in file %s, using default", line_num, file_name);
+            return config_default();
         }
 
-        usz const MAX_TOKEN_LEN = 5;
-        char key[MAX_TOKEN_LEN + 5];
-        usz val;
-        sscanf(line_buf, "%5s=%zu\n", key, &val);
-
-        if (strcmp("dim_x", key) == 0) {
-            self.dim_x = val;
-        } else if (strcmp("dim_y", key) == 0) {
-            self.dim_y = val;
-        } else if (strcmp("dim_z", key) == 0) {
-            self.dim_z = val;
-        } else if (strcmp("niter", key) == 0) {
-            self.niter = val;
-        } else {
-            warn("unknown key `%s` at line %zu", key, line_num);
+        if (!config_set(&self, key, val)) {
+            warn("invalid line %zu in file %s, using default", line_num, file_name);
             return config_default();
         }
     }
 
     free(line_buf);
     fclose(cfp);
+    config_apply_env(&self);
     return self;
 }
 
@@ -79,7 +344,143 @@ inline usz config_niter(config_t self) {
     return self.niter;
 }
 
+inline usz config_order(config_t self) {
+    return self.order;
+}
+
+inline mesh_alloc_t config_alloc(config_t self) {
+    return self.alloc;
+}
+
+inline solve_buffering_t config_buffering(config_t self) {
+    return self.buffering;
+}
+
+inline bool config_product(config_t self) {
+    return self.product;
+}
+
+inline kernel_isa_t config_simd(config_t self) {
+    return self.simd;
+}
+
+inline usz config_time_block(config_t self) {
+    return self.time_block;
+}
+
+inline bool config_overlap(config_t self) {
+    return self.overlap;
+}
+
+inline comm_exchange_t config_exchange(config_t self) {
+    return self.exchange;
+}
+
+inline usz config_halo_depth(config_t self) {
+    return self.halo_depth;
+}
+
+inline comm_balance_t config_balance(config_t self) {
+    return self.balance;
+}
+
+inline char const* config_weights(config_t const* self) {
+    return self->weights;
+}
+
+inline usz config_rebalance(config_t self) {
+    return self.rebalance;
+}
+
+inline usz config_metrics_batch(config_t self) {
+    return self.metrics_batch;
+}
+
+inline usz config_snapshot(config_t self) {
+    return self.snapshot;
+}
+
+inline char const* config_snapshot_path(config_t const* self) {
+    return self->snapshot_path;
+}
+
+inline usz config_snapshot_step(config_t self) {
+    return self.snapshot_step;
+}
+
+inline snapshot_region_t config_snapshot_region(config_t self) {
+    return self.snapshot_region;
+}
+
+inline usz config_checkpoint(config_t self) {
+    return self.checkpoint;
+}
+
+inline char const* config_checkpoint_path(config_t const* self) {
+    return self->checkpoint_path;
+}
+
+inline bool config_restart(config_t self) {
+    return self.restart;
+}
+
+inline char const* config_instrument(config_t const* self) {
+    return self->instrument;
+}
+
+inline bool config_perf(config_t self) {
+    return self.perf;
+}
+
+inline char const* config_trace(config_t const* self) {
+    return self->trace;
+}
+
+inline usz config_trace_events(config_t self) {
+    return self.trace_events;
+}
+
+inline bool config_progress(config_t self) {
+    return self.progress;
+}
+
+inline solve_sweep_t config_sweep(config_t self) {
+    return self.sweep;
+}
+
+inline solve_tile_t config_tile(config_t self) {
+    return self.tile;
+}
+
+inline bool config_autotune(config_t self) {
+    return self.autotune;
+}
+
+inline char const* config_tune_cache(config_t const* self) {
+    return self->tune_cache;
+}
+
+inline usz config_threads(config_t self) {
+    return self.threads;
+}
+
+inline team_affinity_t config_affinity(config_t self) {
+    return self.affinity;
+}
+
 void config_print(config_t const* self) {
+    static char const* PAGES_STR[] = {"default", "transparent huge pages", "hugetlbfs"};
+    static char const* NUMA_STR[] = {"local", "interleave"};
+    static char const* BUFFERING_STR[] = {"swap", "copy"};
+    static char const* SWEEP_STR[] = {"blocked", "streaming"};
+    static char const* SIMD_STR[] = {"auto", "scalar", "sse2", "avx2", "avx512"};
+    static char const* AFFINITY_STR[] = {"none", "compact", "spread"};
+    static char const* EXCHANGE_STR[] = {
+        "point-to-point",
+        "neighborhood collective",
+        "shared memory on the node",
+    };
+    static char const* BALANCE_STR[] = {"even", "calibrated", "weights file"};
     fprintf(
         stderr,
         "****************************************\n"
@@ -87,10 +488,82 @@ void config_print(config_t const* self) {
         "X-axis dimension ................... %zu\n"
         "Y-axis dimension ................... %zu\n"
         "Z-axis dimension ................... %zu\n"
-        "Number of iterations ............... %zu\n",
+        "Number of iterations ............... %zu\n"
+        "Stencil order ...................... %zu\n"
+        "Mesh pages ......................... %s\n"
+        "Mesh NUMA policy ................... %s\n"
+        "Iteration buffering ................ %s\n"
+        "Precomputed A*B product ............ %s\n"
+        "Requested stencil kernel ........... %s\n"
+        "Temporal block depth ............... %zu\n"
+        "Overlapped ghost exchange .......... %s\n"
+        "Ghost exchange ..................... %s\n"
+        "Iterations per ghost exchange ...... %zu\n"
+        "Load balancing ..................... %s\n"
+        "Weights file ....................... %s\n"
+        "Rebalance after .................... %zu iterations\n"
+        "Metrics batch ...................... %zu iterations\n"
+        "Snapshot every ..................... %zu iterations\n"
+        "Snapshot file ...................... %s\n"
+        "Snapshot step ...................... %zu\n"
+        "Snapshot region .................... %zu,%zu,%zu,%zu,%zu,%zu\n"
+        "Checkpoint every ................... %zu iterations\n"
+        "Checkpoint files ................... %s.RANK\n"
+        "Restart from checkpoint ............ %s\n"
+        "Instrumentation report ............. %s\n"
+        "Roofline from hardware events ...... %s\n"
+        "Trace .............................. %s\n"
+        "Trace events per thread ............ %zu\n"
+        "Communication progress thread ...... %s\n"
+        "Sweep .............................. %s\n"
+        "Tile shape ......................... %zux%zux%zu\n"
+        "Autotuning ......................... %s\n"
+        "Tuning cache ....................... %s\n"
+        "Threads per rank ................... %zu%s\n"
+        "Thread affinity .................... %s\n",
         self->dim_x,
         self->dim_y,
         self->dim_z,
-        self->niter
+        self->niter,
+        self->order,
+        PAGES_STR[self->alloc.pages],
+        NUMA_STR[self->alloc.numa],
+        BUFFERING_STR[self->buffering],
+        self->product ? "yes" : "no",
+        SIMD_STR[self->simd],
+        self->time_block,
+        self->overlap ? "yes" : "no",
+        EXCHANGE_STR[self->exchange],
+        self->halo_depth,
+        BALANCE_STR[self->balance],
+        self->weights,
+        self->rebalance,
+        self->metrics_batch,
+        self->snapshot,
+        self->snapshot_path,
+        self->snapshot_step,
+        self->snapshot_region.lo[0],
+        self->snapshot_region.lo[1],
+        self->snapshot_region.lo[2],
+        self->snapshot_region.hi[0],
+        self->snapshot_region.hi[1],
+        self->snapshot_region.hi[2],
+        self->checkpoint,
+        self->checkpoint_path,
+        self->restart ? "yes" : "no",
+        ('\0' == self->instrument[0]) ? "none" : self->instrument,
+        self->perf ? "yes" : "no",
+        ('\0' == self->trace[0]) ? "none" : self->trace,
+        self->trace_events,
+        self->progress ? "yes" : "no",
+        SWEEP_STR[self->sweep],
+        self->tile.x,
+        self->tile.y,
+        self->tile.z,
+        self->autotune ? "yes" : "no",
+        self->tune_cache,
+        self->threads,
+        (0 == self->threads) ? " (automatic)" : "",
+        AFFINITY_STR[self->affinity]
     );
 }
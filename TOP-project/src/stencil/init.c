@@ -1,7 +1,9 @@
 #include "stencil/init.h"
 
 #include "stencil/comm_handler.h"
+#include "stencil/instrument.h"
 #include "stencil/mesh.h"
+#include "stencil/solve.h"
 
 #include <assert.h>
 #include <math.h>
@@ -12,70 +14,104 @@ static f64 compute_core_pressure(usz i, usz j, usz k) {
     return sin((f64)k * cos((f64)i + 0.311) * cos((f64)j + 0.817) + 0.613);
 }
 
-static void setup_mesh_cell_values(mesh_t* mesh, comm_handler_t const* comm_handler) {
-    #pragma omp parallel for collapse(3)
-    for (usz i = 0; i < mesh->dim_x; ++i) {
-        for (usz j = 0; j < mesh->dim_y; ++j) {
-            for (usz k = 0; k < mesh->dim_z; ++k) {
-                switch (mesh->kind) {
-                    case MESH_KIND_CONSTANT:
-                        mesh->cells[i][j][k].value = compute_core_pressure(
-                            comm_handler->coord_x + i,
-                            comm_handler->coord_y + j,
-                            comm_handler->coord_z + k
-                        );
-                        break;
-                    case MESH_KIND_INPUT:
-                        if ((i >= STENCIL_ORDER && (i < mesh->dim_x - STENCIL_ORDER)) &&
-                            (j >= STENCIL_ORDER && (j < mesh->dim_y - STENCIL_ORDER)) &&
-                            (k >= STENCIL_ORDER && (k < mesh->dim_z - STENCIL_ORDER)))
-                        {
-                            mesh->cells[i][j][k].value = 1.0;
-                        } else {
-                            mesh->cells[i][j][k].value = 0.0;
-                        }
-                        break;
-                    case MESH_KIND_OUTPUT:
-                        mesh->cells[i][j][k].value = 0.0;
-                        break;
-                    default:
-                        __builtin_unreachable();
+static f64 initial_cell_value(
+    mesh_t const* mesh, comm_handler_t const* comm_handler, usz i, usz j, usz k
+) {
+    switch (mesh->kind) {
+        case MESH_KIND_CONSTANT:
+            // Offset by the order whatever the width of the ghost layers, so that a cell has the
+            // same value with deep ghost layers
+            return compute_core_pressure(
+                comm_handler->coord_x + i - mesh->ghost + mesh->order,
+                comm_handler->coord_y + j - mesh->ghost + mesh->order,
+                comm_handler->coord_z + k - mesh->ghost + mesh->order
+            );
+        case MESH_KIND_INPUT:
+            return CELL_KIND_CORE == mesh_set_cell_kind(mesh, i, j, k) ? 1.0 : 0.0;
+        case MESH_KIND_OUTPUT:
+        case MESH_KIND_PRODUCT:
+            return 0.0;
+        default:
+            __builtin_unreachable();
+    }
+}
+
+static void setup_row_cell_values(
+    mesh_t* mesh, comm_handler_t const* comm_handler, usz i, usz j, usz k_start, usz k_end
+) {
+    for (usz k = k_start; k < k_end; ++k) {
+        *idx(mesh, i, j, k) = initial_cell_value(mesh, comm_handler, i, j, k);
+    }
+}
+
+static void setup_mesh_cell_values(
+    mesh_t* mesh, comm_handler_t const* comm_handler, solve_tile_t tile
+) {
+    usz const dim_x = mesh->dim_x;
+    usz const dim_y = mesh->dim_y;
+    usz const dim_z = mesh->dim_z;
+    usz const ghost = mesh->ghost;
+    INSTRUMENT_SCOPE(INSTRUMENT_PHASE_INIT);
+    u64 nb_cells = 0;
+
+    // First-touch the core with the same tiles and static schedule as `solve_jacobi`, so that
+    // each page lands on the NUMA node of the thread that computes it
+    #pragma omp for collapse(3) schedule(static)
+    for (usz i = ghost; i < dim_x - ghost; i += tile.x) {
+        for (usz j = ghost; j < dim_y - ghost; j += tile.y) {
+            for (usz k = ghost; k < dim_z - ghost; k += tile.z) {
+                for (usz bi = i; bi < i + tile.x && bi < dim_x - ghost; ++bi) {
+                    for (usz bj = j; bj < j + tile.y && bj < dim_y - ghost; ++bj) {
+                        usz const k_end = (k + tile.z < dim_z - ghost)
+                                              ? k + tile.z
+                                              : dim_z - ghost;
+                        setup_row_cell_values(mesh, comm_handler, bi, bj, k, k_end);
+                        nb_cells += k_end - k;
+                    }
                 }
             }
         }
     }
-}
 
-static void setup_mesh_cell_kinds(mesh_t* mesh) {
-    #pragma omp parallel for collapse(3)
-    for (usz i = 0; i < mesh->dim_x; ++i) {
-        for (usz j = 0; j < mesh->dim_y; ++j) {
-            for (usz k = 0; k < mesh->dim_z; ++k) {
-                mesh->cells[i][j][k].kind = mesh_set_cell_kind(mesh, i, j, k);
+    // Ghost cells: whole rows on the X/Y shell, both ends of the rows of the core
+    #pragma omp for collapse(2) schedule(static)
+    for (usz i = 0; i < dim_x; ++i) {
+        for (usz j = 0; j < dim_y; ++j) {
+            bool const ghost_row = i < ghost || i >= dim_x - ghost ||
+                                   j < ghost || j >= dim_y - ghost;
+            if (ghost_row) {
+                setup_row_cell_values(mesh, comm_handler, i, j, 0, dim_z);
+            } else {
+                setup_row_cell_values(mesh, comm_handler, i, j, 0, ghost);
+                setup_row_cell_values(mesh, comm_handler, i, j, dim_z - ghost, dim_z);
             }
         }
     }
+    INSTRUMENT_COUNT(INSTRUMENT_PHASE_INIT, INSTRUMENT_COUNTER_CELLS, nb_cells);
 }
 
-void init_meshes(mesh_t* A, mesh_t* B, mesh_t* C, comm_handler_t const* comm_handler) {
+void init_mesh(mesh_t* mesh, comm_handler_t const* comm_handler, solve_tile_t tile) {
+    setup_mesh_cell_values(mesh, comm_handler, tile);
+}
+
+void init_meshes(
+    mesh_t* A, mesh_t* B, mesh_t* C, comm_handler_t const* comm_handler, solve_tile_t tile
+) {
+    assert(A->ghost == B->ghost && B->ghost == C->ghost);
     assert(
         A->dim_x == B->dim_x && B->dim_x == C->dim_x &&
-        C->dim_x == comm_handler->loc_dim_x + STENCIL_ORDER * 2
+        C->dim_x == comm_handler->loc_dim_x + A->ghost * 2
     );
     assert(
         A->dim_y == B->dim_y && B->dim_y == C->dim_y &&
-        C->dim_y == comm_handler->loc_dim_y + STENCIL_ORDER * 2
+        C->dim_y == comm_handler->loc_dim_y + A->ghost * 2
     );
     assert(
         A->dim_z == B->dim_z && B->dim_z == C->dim_z &&
-        C->dim_z == comm_handler->loc_dim_z + STENCIL_ORDER * 2
+        C->dim_z == comm_handler->loc_dim_z + A->ghost * 2
     );
 
-    setup_mesh_cell_kinds(A);
-    setup_mesh_cell_kinds(B);
-    setup_mesh_cell_kinds(C);
-
-    setup_mesh_cell_values(A, comm_handler);
-    setup_mesh_cell_values(B, comm_handler);
-    setup_mesh_cell_values(C, comm_handler);
+    setup_mesh_cell_values(A, comm_handler, tile);
+    setup_mesh_cell_values(B, comm_handler, tile);
+    setup_mesh_cell_values(C, comm_handler, tile);
 }
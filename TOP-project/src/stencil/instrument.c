@@ -0,0 +1,657 @@
+#include "stencil/instrument.h"
+#include "logging.h"
+
+#include <math.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Event of a trace: a phase, or an instant event (`INSTRUMENT_NB_PHASES`) with a value.
+typedef struct instrument_event_s {
+    char const* name;
+    instrument_phase_t phase;
+    /// Timepoint (in nanoseconds) of the beginning of the phase, or of the instant event.
+    u64 begin;
+    union {
+        /// Timepoint of the end of the phase.
+        u64 end;
+        u64 value;
+    };
+} instrument_event_t;
+
+/// Timings, counters, hardware events and trace of a thread, on their own cache lines.
+typedef struct instrument_slot_s {
+    f64 seconds[INSTRUMENT_NB_PHASES];
+    u64 calls[INSTRUMENT_NB_PHASES];
+    u64 counters[INSTRUMENT_NB_PHASES][INSTRUMENT_NB_COUNTERS];
+    u64 events[INSTRUMENT_NB_PHASES][PERF_NB_EVENTS];
+    /// Hardware events of the thread, only valid if they were opened.
+    bool counting;
+    perf_group_t group;
+    /// Ring of the last `capacity` events of the thread (NULL if it is not traced), the next one is
+    /// recorded at `next`, `nb_traced` were recorded in total.
+    instrument_event_t* ring;
+    usz capacity;
+    usz next;
+    u64 nb_traced;
+} __attribute__((aligned(PERF_CACHE_LINE))) instrument_slot_t;
+
+static instrument_slot_t SLOTS[INSTRUMENT_MAX_THREADS];
+
+/// Returns the slot of the calling thread, NULL if it has none.
+static instrument_slot_t* own_slot(void) {
+    i32 const thread = omp_get_thread_num();
+    return (thread < INSTRUMENT_MAX_THREADS) ? &SLOTS[thread] : NULL;
+}
+
+/// Returns a timepoint in nanoseconds.
+static u64 nanos_of(struct timespec t) {
+    return (u64)t.tv_sec * 1000000000 + (u64)t.tv_nsec;
+}
+
+/// Records `event` in the ring of `slot`, overwriting the oldest one if it is full.
+static void trace(instrument_slot_t* slot, instrument_event_t event) {
+    slot->ring[slot->next] = event;
+    slot->next = (slot->next + 1 == slot->capacity) ? 0 : slot->next + 1;
+    slot->nb_traced += 1;
+}
+
+instrument_scope_t instrument_scope_begin(
+    instrument_phase_t phase, char const name[static 1], bool call
+) {
+    instrument_scope_t scope = {.phase = phase, .name = name, .call = call};
+    instrument_slot_t const* slot = own_slot();
+    // Reading the events is a system call, only paid around the phases of the roofline
+    scope.counting = NULL != slot && slot->counting &&
+                     (INSTRUMENT_PHASE_SOLVE == phase || INSTRUMENT_PHASE_EXCHANGE == phase);
+    if (scope.counting) {
+        perf_group_read(&slot->group, scope.events);
+    }
+    chrono_start(&scope.chrono);
+    return scope;
+}
+
+void instrument_scope_end(instrument_scope_t* scope) {
+    chrono_stop(&scope->chrono);
+    instrument_slot_t* slot = own_slot();
+    if (NULL != slot) {
+        slot->seconds[scope->phase] += duration_as_s_f64(chrono_elapsed(scope->chrono));
+        slot->calls[scope->phase] += scope->call ? 1 : 0;
+        if (NULL != slot->ring) {
+            trace(
+                slot,
+                (instrument_event_t){
+                    .name = scope->name,
+                    .phase = scope->phase,
+                    .begin = nanos_of(scope->chrono.start),
+                    .end = nanos_of(scope->chrono.stop),
+                }
+            );
+        }
+    }
+    if (scope->counting) {
+        u64 events[PERF_NB_EVENTS];
+        perf_group_read(&slot->group, events);
+        for (usz e = 0; e < PERF_NB_EVENTS; ++e) {
+            slot->events[scope->phase][e] += events[e] - scope->events[e];
+        }
+    }
+}
+
+void instrument_count(instrument_phase_t phase, instrument_counter_t counter, u64 n) {
+    instrument_slot_t* slot = own_slot();
+    if (NULL != slot) {
+        slot->counters[phase][counter] += n;
+    }
+}
+
+void instrument_mark(char const name[static 1], u64 value) {
+    instrument_slot_t* slot = own_slot();
+    if (NULL != slot && NULL != slot->ring) {
+        chrono_t now;
+        chrono_start(&now);
+        trace(
+            slot,
+            (instrument_event_t){
+                .name = name,
+                .phase = INSTRUMENT_NB_PHASES,
+                .begin = nanos_of(now.start),
+                .value = value,
+            }
+        );
+    }
+}
+
+/// Statistics of a phase over the threads of all ranks, and over the ranks.
+typedef struct phase_stats_s {
+    f64 thread_min;
+    f64 thread_max;
+    f64 thread_sum;
+    f64 nb_threads;
+    f64 rank_min;
+    f64 rank_max;
+    f64 rank_sum;
+    f64 nb_ranks;
+    f64 calls;
+    f64 counters[INSTRUMENT_NB_COUNTERS];
+} phase_stats_t;
+
+/// Returns the maximum over the mean minus one, 0 if the mean is 0.
+static f64 imbalance(f64 max, f64 sum, f64 nb) {
+    return (sum > 0.0) ? max * nb / sum - 1.0 : 0.0;
+}
+
+static char const* PHASE_NAMES[INSTRUMENT_NB_PHASES] = {
+    "init",
+    "solve",
+    "copy",
+    "exchange",
+    "barrier",
+    "output",
+};
+
+static void write_csv(FILE* f, phase_stats_t const stats[static INSTRUMENT_NB_PHASES]) {
+    fprintf(
+        f,
+        "phase,calls,threads,thread_min_s,thread_mean_s,thread_max_s,thread_imbalance,"
+        "ranks,rank_min_s,rank_mean_s,rank_max_s,rank_imbalance,bytes,messages,cells\n"
+    );
+    for (usz p = 0; p < INSTRUMENT_NB_PHASES; ++p) {
+        phase_stats_t const* s = &stats[p];
+        if (0.0 == s->nb_threads) {
+            continue;
+        }
+        fprintf(
+            f,
+            "%s,%.0lf,%.0lf,%.9lf,%.9lf,%.9lf,%.4lf,"
+            "%.0lf,%.9lf,%.9lf,%.9lf,%.4lf,%.0lf,%.0lf,%.0lf\n",
+            PHASE_NAMES[p],
+            s->calls,
+            s->nb_threads,
+            s->thread_min,
+            s->thread_sum / s->nb_threads,
+            s->thread_max,
+            imbalance(s->thread_max, s->thread_sum, s->nb_threads),
+            s->nb_ranks,
+            s->rank_min,
+            s->rank_sum / s->nb_ranks,
+            s->rank_max,
+            imbalance(s->rank_max, s->rank_sum, s->nb_ranks),
+            s->counters[INSTRUMENT_COUNTER_BYTES],
+            s->counters[INSTRUMENT_COUNTER_MESSAGES],
+            s->counters[INSTRUMENT_COUNTER_CELLS]
+        );
+    }
+}
+
+static void write_json(FILE* f, phase_stats_t const stats[static INSTRUMENT_NB_PHASES]) {
+    fprintf(f, "{\n  \"phases\": [");
+    bool first = true;
+    for (usz p = 0; p < INSTRUMENT_NB_PHASES; ++p) {
+        phase_stats_t const* s = &stats[p];
+        if (0.0 == s->nb_threads) {
+            continue;
+        }
+        fprintf(
+            f,
+            "%s\n    {\"phase\": \"%s\", \"calls\": %.0lf,\n"
+            "     \"threads\": {\"count\": %.0lf, \"min_s\": %.9lf, \"mean_s\": %.9lf, "
+            "\"max_s\": %.9lf, \"imbalance\": %.4lf},\n"
+            "     \"ranks\": {\"count\": %.0lf, \"min_s\": %.9lf, \"mean_s\": %.9lf, "
+            "\"max_s\": %.9lf, \"imbalance\": %.4lf},\n"
+            "     \"bytes\": %.0lf, \"messages\": %.0lf, \"cells\": %.0lf}",
+            first ? "" : ",",
+            PHASE_NAMES[p],
+            s->calls,
+            s->nb_threads,
+            s->thread_min,
+            s->thread_sum / s->nb_threads,
+            s->thread_max,
+            imbalance(s->thread_max, s->thread_sum, s->nb_threads),
+            s->nb_ranks,
+            s->rank_min,
+            s->rank_sum / s->nb_ranks,
+            s->rank_max,
+            imbalance(s->rank_max, s->rank_sum, s->nb_ranks),
+            s->counters[INSTRUMENT_COUNTER_BYTES],
+            s->counters[INSTRUMENT_COUNTER_MESSAGES],
+            s->counters[INSTRUMENT_COUNTER_CELLS]
+        );
+        first = false;
+    }
+    fprintf(f, "\n  ]\n}\n");
+}
+
+void instrument_report(MPI_Comm comm, char const path[static 1]) {
+    // Local statistics over the threads that ran each phase, a rank taking as long as the slowest
+    // one. Ranks or threads that did not run a phase are left out of its extremes and means.
+    phase_stats_t stats[INSTRUMENT_NB_PHASES];
+    for (usz p = 0; p < INSTRUMENT_NB_PHASES; ++p) {
+        phase_stats_t* s = &stats[p];
+        *s = (phase_stats_t){.thread_min = INFINITY, .thread_max = -INFINITY};
+        for (usz t = 0; t < INSTRUMENT_MAX_THREADS; ++t) {
+            instrument_slot_t const* slot = &SLOTS[t];
+            for (usz c = 0; c < INSTRUMENT_NB_COUNTERS; ++c) {
+                s->counters[c] += (f64)slot->counters[p][c];
+            }
+            if (0 == slot->calls[p]) {
+                continue;
+            }
+            s->thread_min = fmin(s->thread_min, slot->seconds[p]);
+            s->thread_max = fmax(s->thread_max, slot->seconds[p]);
+            s->thread_sum += slot->seconds[p];
+            s->nb_threads += 1.0;
+            s->calls += (f64)slot->calls[p];
+        }
+        bool const ran = s->nb_threads > 0.0;
+        s->rank_min = ran ? s->thread_max : INFINITY;
+        s->rank_max = ran ? s->thread_max : -INFINITY;
+        s->rank_sum = ran ? s->thread_max : 0.0;
+        s->nb_ranks = ran ? 1.0 : 0.0;
+    }
+
+    // Minima, maxima and sums are reduced field by field
+    usz const nb_fields = sizeof(phase_stats_t) / sizeof(f64);
+    i32 const count = (i32)(INSTRUMENT_NB_PHASES * nb_fields);
+    phase_stats_t mins[INSTRUMENT_NB_PHASES];
+    phase_stats_t maxs[INSTRUMENT_NB_PHASES];
+    phase_stats_t sums[INSTRUMENT_NB_PHASES];
+    MPI_Reduce(stats, mins, count, MPI_DOUBLE, MPI_MIN, 0, comm);
+    MPI_Reduce(stats, maxs, count, MPI_DOUBLE, MPI_MAX, 0, comm);
+    MPI_Reduce(stats, sums, count, MPI_DOUBLE, MPI_SUM, 0, comm);
+    i32 rank;
+    MPI_Comm_rank(comm, &rank);
+    if (0 != rank) {
+        return;
+    }
+#ifndef STENCIL_INSTRUMENT
+    warn("instrumentation is compiled out, the phases in %s are not timed", path);
+#endif
+    for (usz p = 0; p < INSTRUMENT_NB_PHASES; ++p) {
+        sums[p].thread_min = mins[p].thread_min;
+        sums[p].rank_min = mins[p].rank_min;
+        sums[p].thread_max = maxs[p].thread_max;
+        sums[p].rank_max = maxs[p].rank_max;
+    }
+
+    FILE* f = fopen(path, "w");
+    if (NULL == f) {
+        warn("failed to open instrumentation report %s", path);
+        return;
+    }
+    usz const len = strlen(path);
+    if (len >= 5 && 0 == strcmp(".json", path + len - 5)) {
+        write_json(f, sums);
+    } else {
+        write_csv(f, sums);
+    }
+    fclose(f);
+    info("instrumentation report written to %s", path);
+}
+
+bool instrument_events_open(void) {
+    instrument_slot_t* slot = own_slot();
+    if (NULL == slot) {
+        return false;
+    }
+    if (slot->counting) {
+        perf_group_close(&slot->group);
+    }
+    slot->group = perf_group_open();
+    slot->counting = slot->group.leader >= 0;
+    return slot->counting;
+}
+
+void instrument_reset(void) {
+    for (usz t = 0; t < INSTRUMENT_MAX_THREADS; ++t) {
+        instrument_slot_t* slot = &SLOTS[t];
+        *slot = (instrument_slot_t){
+            .counting = slot->counting,
+            .group = slot->group,
+            .ring = slot->ring,
+            .capacity = slot->capacity,
+        };
+    }
+}
+
+/// Events and timings of the phases of the roofline, summed over the threads of a rank.
+typedef struct roofline_stats_s {
+    f64 events[2][PERF_NB_EVENTS];
+    /// Cells computed by the solver, and time of the rank in the solver (its slowest thread).
+    f64 cells;
+    f64 solve_s;
+    f64 bandwidth;
+    f64 flops;
+} roofline_stats_t;
+
+/// Phases whose events are counted, in the order of `roofline_stats_t`.
+static instrument_phase_t const ROOFLINE_PHASES[2] = {
+    INSTRUMENT_PHASE_SOLVE,
+    INSTRUMENT_PHASE_EXCHANGE,
+};
+
+void instrument_roofline(
+    MPI_Comm comm, char const name[static 1], usz flops_per_cell, perf_ceilings_t ceilings
+) {
+    roofline_stats_t local = {.bandwidth = ceilings.bandwidth, .flops = ceilings.flops};
+    // Events are available on a rank if all of its threads that ran a phase counted them
+    f64 available[PERF_NB_EVENTS];
+    for (usz e = 0; e < PERF_NB_EVENTS; ++e) {
+        available[e] = 1.0;
+    }
+    for (usz t = 0; t < INSTRUMENT_MAX_THREADS; ++t) {
+        instrument_slot_t* slot = &SLOTS[t];
+        for (usz p = 0; p < 2; ++p) {
+            for (usz e = 0; e < PERF_NB_EVENTS; ++e) {
+                local.events[p][e] += (f64)slot->events[ROOFLINE_PHASES[p]][e];
+            }
+        }
+        local.cells += (f64)slot->counters[INSTRUMENT_PHASE_SOLVE][INSTRUMENT_COUNTER_CELLS];
+        local.solve_s = fmax(local.solve_s, slot->seconds[INSTRUMENT_PHASE_SOLVE]);
+        if (0 != slot->calls[INSTRUMENT_PHASE_SOLVE]) {
+            for (usz e = 0; e < PERF_NB_EVENTS; ++e) {
+                bool const counted = slot->counting && slot->group.slots[e] >= 0;
+                available[e] = fmin(available[e], counted ? 1.0 : 0.0);
+            }
+        }
+        if (slot->counting) {
+            perf_group_close(&slot->group);
+            slot->counting = false;
+        }
+    }
+
+    roofline_stats_t sums;
+    f64 solve_max;
+    i32 const count = (i32)(sizeof(roofline_stats_t) / sizeof(f64));
+    MPI_Reduce(&local, &sums, count, MPI_DOUBLE, MPI_SUM, 0, comm);
+    MPI_Reduce(&local.solve_s, &solve_max, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    MPI_Allreduce(MPI_IN_PLACE, available, PERF_NB_EVENTS, MPI_DOUBLE, MPI_MIN, comm);
+    i32 rank;
+    MPI_Comm_rank(comm, &rank);
+    if (0 != rank) {
+        return;
+    }
+#ifndef STENCIL_INSTRUMENT
+    warn("instrumentation is compiled out, the roofline of `%s` is not measured", name);
+    return;
+#endif
+    if (0.0 == sums.cells || 0.0 == solve_max) {
+        warn("no cell computed by `%s`, no roofline to report", name);
+        return;
+    }
+    if (0.0 == available[PERF_EVENT_CYCLES]) {
+        warn(
+            "hardware events are not available (see %s), only the time is measured",
+            "/proc/sys/kernel/perf_event_paranoid"
+        );
+    }
+
+    // Memory traffic of the solver, from the memory events if the CPU exposes them, else from the
+    // last level cache misses, else the compulsory reads of A and B and write of C
+    f64 const* solve = sums.events[0];
+    f64 const* exchange = sums.events[1];
+    f64 bytes_per_cell = 3.0 * sizeof(f64);
+    char const* traffic = "compulsory, no counters";
+    if (0.0 != available[PERF_EVENT_MEMORY_READS] && 0.0 != available[PERF_EVENT_MEMORY_WRITES]) {
+        bytes_per_cell = (solve[PERF_EVENT_MEMORY_READS] + solve[PERF_EVENT_MEMORY_WRITES]) *
+                         PERF_CACHE_LINE / sums.cells;
+        traffic = "memory events";
+    } else if (0.0 != available[PERF_EVENT_LLC_MISSES]) {
+        bytes_per_cell = solve[PERF_EVENT_LLC_MISSES] * PERF_CACHE_LINE / sums.cells;
+        traffic = "last level cache misses";
+    }
+
+    f64 const flops = sums.cells * (f64)flops_per_cell;
+    f64 const gflops = flops / solve_max * 1e-9;
+    f64 const intensity = (bytes_per_cell > 0.0) ? (f64)flops_per_cell / bytes_per_cell : INFINITY;
+    f64 const roof_bandwidth = sums.bandwidth * 1e-9;
+    f64 const roof_flops = sums.flops * 1e-9;
+    f64 const attainable = fmin(roof_flops, intensity * roof_bandwidth);
+
+    fprintf(
+        stderr,
+        "****************************************\n"
+        "         ROOFLINE\n"
+        "Kernel ............................. %s\n"
+        "Bandwidth ceiling .................. %.2lf GB/s\n"
+        "Peak (kernel in cache) ............. %.2lf GFLOP/s\n"
+        "Ridge point ........................ %.3lf FLOP/B\n"
+        "Operations per cell ................ %zu FLOP\n"
+        "Traffic per cell ................... %.2lf B (%s)\n"
+        "Arithmetic intensity ............... %.3lf FLOP/B\n"
+        "Attainable ......................... %.2lf GFLOP/s (%s bound)\n"
+        "Achieved ........................... %.2lf GFLOP/s (%.1lf %% of attainable)\n",
+        name,
+        roof_bandwidth,
+        roof_flops,
+        roof_flops / roof_bandwidth,
+        flops_per_cell,
+        bytes_per_cell,
+        traffic,
+        intensity,
+        attainable,
+        (intensity * roof_bandwidth < roof_flops) ? "memory" : "compute",
+        gflops,
+        100.0 * gflops / attainable
+    );
+    if (0.0 != available[PERF_EVENT_CYCLES]) {
+        f64 const* events[2] = {solve, exchange};
+        char const* labels[2] = {
+            "Instructions per cycle (solve) .....",
+            "Instructions per cycle (exchange) ..",
+        };
+        for (usz p = 0; p < 2; ++p) {
+            f64 const cycles = events[p][PERF_EVENT_CYCLES];
+            fprintf(
+                stderr,
+                "%s %.2lf (%.3lf LLC misses per cell)\n",
+                labels[p],
+                (cycles > 0.0) ? events[p][PERF_EVENT_INSTRUCTIONS] / cycles : 0.0,
+                events[p][PERF_EVENT_LLC_MISSES] / sums.cells
+            );
+        }
+    }
+}
+
+void instrument_trace_open(usz capacity) {
+    instrument_slot_t* slot = own_slot();
+    if (NULL == slot) {
+        return;
+    }
+    free(slot->ring);
+    slot->ring = malloc(capacity * sizeof(instrument_event_t));
+    if (NULL == slot->ring) {
+        error("failed to allocate a trace of %zu events", capacity);
+    }
+    memset(slot->ring, 0, capacity * sizeof(instrument_event_t));
+    slot->capacity = capacity;
+    slot->next = 0;
+    slot->nb_traced = 0;
+}
+
+/// Largest chunk of a trace sent at once to rank 0.
+#define TRACE_CHUNK (1UL << 30)
+
+instrument_tile_t instrument_tile_begin(void) {
+    instrument_slot_t const* slot = own_slot();
+    if (NULL == slot || NULL == slot->ring) {
+        return (instrument_tile_t){.begin = 0};
+    }
+    chrono_t now;
+    chrono_start(&now);
+    return (instrument_tile_t){.begin = nanos_of(now.start)};
+}
+
+void instrument_tile_end(instrument_tile_t* tile) {
+    if (0 == tile->begin) {
+        return;
+    }
+    chrono_t now;
+    chrono_start(&now);
+    trace(
+        own_slot(),
+        (instrument_event_t){
+            .name = "tile",
+            .phase = INSTRUMENT_PHASE_SOLVE,
+            .begin = tile->begin,
+            .end = nanos_of(now.start),
+        }
+    );
+}
+
+/// Formats the events of the threads of rank `rank` as Chrome trace events, each preceded by a
+/// comma, with timestamps (in microseconds) relative to `origin`.
+static void format_trace(FILE* f, i32 rank, u64 origin) {
+    fprintf(
+        f,
+        ",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"rank %d\"}}"
+        ",\n{\"name\":\"process_sort_index\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"sort_index\":%d}}",
+        rank,
+        rank,
+        rank,
+        rank
+    );
+    for (usz t = 0; t < INSTRUMENT_MAX_THREADS; ++t) {
+        instrument_slot_t const* slot = &SLOTS[t];
+        if (NULL == slot->ring) {
+            continue;
+        }
+        fprintf(
+            f,
+            ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%zu,"
+            "\"args\":{\"name\":\"thread %zu\"}}",
+            rank,
+            t,
+            t
+        );
+        // Oldest event first, the ring starts at the next slot once it wrapped around
+        bool const wrapped = slot->nb_traced > slot->capacity;
+        usz const nb_events = wrapped ? slot->capacity : slot->next;
+        usz const first = wrapped ? slot->next : 0;
+        for (usz e = 0; e < nb_events; ++e) {
+            instrument_event_t const* ev = &slot->ring[(first + e) % slot->capacity];
+            f64 const ts = (f64)(ev->begin - origin) * 1e-3;
+            if (INSTRUMENT_NB_PHASES == ev->phase) {
+                fprintf(
+                    f,
+                    ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%zu,"
+                    "\"ts\":%.3lf,\"args\":{\"value\":%lu}}",
+                    ev->name,
+                    rank,
+                    t,
+                    ts,
+                    ev->value
+                );
+            } else {
+                fprintf(
+                    f,
+                    ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%zu,"
+                    "\"ts\":%.3lf,\"dur\":%.3lf}",
+                    ev->name,
+                    PHASE_NAMES[ev->phase],
+                    rank,
+                    t,
+                    ts,
+                    (f64)(ev->end - ev->begin) * 1e-3
+                );
+            }
+        }
+    }
+}
+
+void instrument_trace_write(MPI_Comm comm, char const path[static 1]) {
+    i32 rank;
+    i32 size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    // Clocks are aligned on the end of a barrier, then shifted so that the earliest event of all
+    // ranks is at 0
+    MPI_Barrier(comm);
+    chrono_t sync;
+    chrono_start(&sync);
+    u64 const local_sync = nanos_of(sync.start);
+    i64 earliest = 0;
+    u64 dropped = 0;
+    for (usz t = 0; t < INSTRUMENT_MAX_THREADS; ++t) {
+        instrument_slot_t const* slot = &SLOTS[t];
+        if (NULL == slot->ring) {
+            continue;
+        }
+        bool const wrapped = slot->nb_traced > slot->capacity;
+        if (slot->nb_traced > 0) {
+            usz const oldest = wrapped ? slot->next : 0;
+            i64 const begin = (i64)(slot->ring[oldest].begin - local_sync);
+            earliest = (begin < earliest) ? begin : earliest;
+        }
+        dropped += wrapped ? slot->nb_traced - slot->capacity : 0;
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &earliest, 1, MPI_INT64_T, MPI_MIN, comm);
+    MPI_Allreduce(MPI_IN_PLACE, &dropped, 1, MPI_UINT64_T, MPI_SUM, comm);
+
+    char* text = NULL;
+    usz len = 0;
+    FILE* mem = open_memstream(&text, &len);
+    if (NULL == mem) {
+        error("failed to format the trace of rank %d", rank);
+    }
+    format_trace(mem, rank, local_sync + (u64)earliest);
+    fclose(mem);
+    for (usz t = 0; t < INSTRUMENT_MAX_THREADS; ++t) {
+        free(SLOTS[t].ring);
+        SLOTS[t].ring = NULL;
+    }
+
+    // Rank 0 writes its events then those of the other ranks in turn, received in chunks
+    if (0 != rank) {
+        u64 const nb_bytes = len;
+        MPI_Send(&nb_bytes, 1, MPI_UINT64_T, 0, 0, comm);
+        for (usz off = 0; off < len; off += TRACE_CHUNK) {
+            i32 const count = (i32)((len - off < TRACE_CHUNK) ? len - off : TRACE_CHUNK);
+            MPI_Send(text + off, count, MPI_CHAR, 0, 0, comm);
+        }
+        free(text);
+        return;
+    }
+
+    FILE* f = fopen(path, "w");
+    if (NULL == f) {
+        warn("failed to open trace %s", path);
+    } else {
+        // The events of rank 0 come first, without the comma before them
+        fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        fwrite(text + 2, 1, len - 2, f);
+    }
+    free(text);
+    char* chunk = NULL;
+    usz chunk_len = 0;
+    for (i32 r = 1; r < size; ++r) {
+        u64 nb_bytes;
+        MPI_Recv(&nb_bytes, 1, MPI_UINT64_T, r, 0, comm, MPI_STATUS_IGNORE);
+        for (u64 off = 0; off < nb_bytes; off += TRACE_CHUNK) {
+            i32 const count = (i32)((nb_bytes - off < TRACE_CHUNK) ? nb_bytes - off : TRACE_CHUNK);
+            if ((usz)count > chunk_len) {
+                chunk_len = (usz)count;
+                chunk = realloc(chunk, chunk_len);
+            }
+            MPI_Recv(chunk, count, MPI_CHAR, r, 0, comm, MPI_STATUS_IGNORE);
+            if (NULL != f) {
+                fwrite(chunk, 1, (usz)count, f);
+            }
+        }
+    }
+    free(chunk);
+    if (NULL == f) {
+        return;
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+#ifndef STENCIL_INSTRUMENT
+    warn("instrumentation is compiled out, the trace %s only holds the ranks", path);
+#endif
+    if (dropped > 0) {
+        warn("%lu events were overwritten, increase `trace_events` to keep them", dropped);
+    }
+    info("trace written to %s", path);
+}
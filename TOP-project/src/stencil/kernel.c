@@ -0,0 +1,191 @@
+#include "stencil/kernel.h"
+
+#include "logging.h"
+
+// Generic rows, instantiated below for each order. They divide by the powers of 17 like the
+// reference implementation does, so that results are reproduced exactly.
+
+static inline __attribute__((always_inline)) void scalar_row(
+    f64 const* restrict a,
+    f64 const* restrict b,
+    f64* restrict c,
+    usz q,
+    usz len,
+    usz sx,
+    usz sy,
+    usz order
+) {
+    for (usz p = q; p < q + len; ++p) {
+        f64 sum = a[p] * b[p];
+        KERNEL_UNROLL_ORDERS
+        for (usz o = 1; o <= order; ++o) {
+            sum += ((a[p + o * sx] * b[p + o * sx])
+                 + (a[p - o * sx] * b[p - o * sx])
+                 + (a[p + o * sy] * b[p + o * sy])
+                 + (a[p - o * sy] * b[p - o * sy])
+                 + (a[p + o] * b[p + o])
+                 + (a[p - o] * b[p - o]))
+                 / KERNEL_POW17[o];
+        }
+        c[p] = sum;
+    }
+}
+
+static inline __attribute__((always_inline)) void scalar_product_row(
+    f64 const* restrict p, f64* restrict c, usz q, usz len, usz sx, usz sy, usz order
+) {
+    for (usz r = q; r < q + len; ++r) {
+        f64 sum = p[r];
+        KERNEL_UNROLL_ORDERS
+        for (usz o = 1; o <= order; ++o) {
+            sum += (p[r + o * sx] + p[r - o * sx]
+                 + p[r + o * sy] + p[r - o * sy]
+                 + p[r + o] + p[r - o])
+                 / KERNEL_POW17[o];
+        }
+        c[r] = sum;
+    }
+}
+
+static inline __attribute__((always_inline)) void scalar_ring_row(
+    f64 const* const planes[static KERNEL_NB_PLANES],
+    f64* restrict c,
+    usz q,
+    usz len,
+    usz sy,
+    usz order
+) {
+    f64 const* p = planes[order];
+    for (usz k = 0; k < len; ++k) {
+        usz const r = q + k;
+        f64 sum = p[r];
+        KERNEL_UNROLL_ORDERS
+        for (usz o = 1; o <= order; ++o) {
+            sum += (planes[order + o][r] + planes[order - o][r]
+                 + p[r + o * sy] + p[r - o * sy]
+                 + p[r + o] + p[r - o])
+                 / KERNEL_POW17[o];
+        }
+        c[k] = sum;
+    }
+}
+
+#define SCALAR_INSTANCE(N)                                                                         \
+    static void scalar_row_##N(                                                                    \
+        f64 const* restrict a,                                                                     \
+        f64 const* restrict b,                                                                     \
+        f64* restrict c,                                                                           \
+        usz q,                                                                                     \
+        usz len,                                                                                   \
+        usz sx,                                                                                    \
+        usz sy                                                                                     \
+    ) {                                                                                            \
+        scalar_row(a, b, c, q, len, sx, sy, N);                                                    \
+    }                                                                                              \
+    static void scalar_product_row_##N(                                                            \
+        f64 const* restrict p, f64* restrict c, usz q, usz len, usz sx, usz sy                     \
+    ) {                                                                                            \
+        scalar_product_row(p, c, q, len, sx, sy, N);                                               \
+    }                                                                                              \
+    static void scalar_ring_row_##N(                                                               \
+        f64 const* const planes[static KERNEL_NB_PLANES], f64* restrict c, usz q, usz len, usz sy  \
+    ) {                                                                                            \
+        scalar_ring_row(planes, c, q, len, sy, N);                                                 \
+    }
+KERNEL_FOR_EACH_ORDER(SCALAR_INSTANCE)
+
+#define SCALAR_KERNEL(N)                                                                           \
+    {                                                                                              \
+        .isa = KERNEL_ISA_SCALAR,                                                                  \
+        .name = "scalar",                                                                          \
+        .order = N,                                                                                \
+        .row = scalar_row_##N,                                                                     \
+        .product_row = scalar_product_row_##N,                                                     \
+        .ring_row = scalar_ring_row_##N,                                                           \
+    },
+kernel_t const KERNEL_SCALAR[KERNEL_NB_ORDERS] = {KERNEL_FOR_EACH_ORDER(SCALAR_KERNEL)};
+
+#define ORDER_VALUE(N) N,
+static usz const ORDERS[] = {KERNEL_FOR_EACH_ORDER(ORDER_VALUE)};
+static_assert(sizeof(ORDERS) / sizeof(ORDERS[0]) == KERNEL_NB_ORDERS, "wrong number of orders");
+
+bool kernel_has_order(usz order) {
+    for (usz o = 0; o < KERNEL_NB_ORDERS; ++o) {
+        if (ORDERS[o] == order) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Returns whether the running CPU supports the instructions of the variants of `isa`.
+static bool kernel_isa_supported(kernel_isa_t isa) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    switch (isa) {
+        case KERNEL_ISA_SSE2:
+            return __builtin_cpu_supports("sse2");
+        case KERNEL_ISA_AVX2:
+            // The variants are compiled with `-mfma`, which is a CPUID bit of its own
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        case KERNEL_ISA_AVX512:
+            return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("fma");
+        default:
+            break;
+    }
+#endif
+    return KERNEL_ISA_SCALAR == isa;
+}
+
+/// Returns the variants of the widest instruction set supported by the running CPU.
+static kernel_t const* kernel_widest(void) {
+#if defined(__x86_64__)
+    if (kernel_isa_supported(KERNEL_ISA_AVX512)) {
+        return KERNEL_AVX512;
+    } else if (kernel_isa_supported(KERNEL_ISA_AVX2)) {
+        return KERNEL_AVX2;
+    } else if (kernel_isa_supported(KERNEL_ISA_SSE2)) {
+        return KERNEL_SSE2;
+    }
+#endif
+    return KERNEL_SCALAR;
+}
+
+/// Returns the variants of the requested instruction set.
+static kernel_t const* kernel_variants(kernel_isa_t isa) {
+    kernel_t const* widest = kernel_widest();
+    if (KERNEL_ISA_AUTO == isa) {
+        return widest;
+    } else if (KERNEL_ISA_SCALAR == isa) {
+        return KERNEL_SCALAR;
+    }
+
+    // Checked on its own rather than against the widest one, the FMA bit being separate
+    if (!kernel_isa_supported(isa)) {
+        warn("requested stencil kernel is not supported by this CPU, using `%s`", widest->name);
+        return widest;
+    }
+#if defined(__x86_64__)
+    switch (isa) {
+        case KERNEL_ISA_SSE2:
+            return KERNEL_SSE2;
+        case KERNEL_ISA_AVX2:
+            return KERNEL_AVX2;
+        case KERNEL_ISA_AVX512:
+            return KERNEL_AVX512;
+        default:
+            break;
+    }
+#endif
+    return widest;
+}
+
+kernel_t const* kernel_select(kernel_isa_t isa, usz order) {
+    kernel_t const* variants = kernel_variants(isa);
+    for (usz o = 0; o < KERNEL_NB_ORDERS; ++o) {
+        if (variants[o].order == order) {
+            return &variants[o];
+        }
+    }
+    error("no stencil kernel of order %zu", order);
+}
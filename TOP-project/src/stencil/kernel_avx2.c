@@ -0,0 +1,18 @@
+#include <immintrin.h>
+#include <math.h>
+
+// AVX2+FMA variant, compiled with `-mavx2 -mfma`
+#define vec_t __m256d
+#define VLEN 4
+#define vload _mm256_loadu_pd
+#define vstore _mm256_storeu_pd
+#define vset1 _mm256_set1_pd
+#define vadd _mm256_add_pd
+#define vmul _mm256_mul_pd
+#define vmadd(x, y, acc) _mm256_fmadd_pd(x, y, acc)
+#define smadd(x, y, acc) fma(x, y, acc)
+
+#define KERNEL_VAR KERNEL_AVX2
+#define KERNEL_ISA KERNEL_ISA_AVX2
+#define KERNEL_NAME "avx2"
+#include "stencil/kernel_simd.h"
@@ -0,0 +1,18 @@
+#include <immintrin.h>
+#include <math.h>
+
+// AVX-512F variant, compiled with `-mavx512f -mfma` for the scalar tails
+#define vec_t __m512d
+#define VLEN 8
+#define vload _mm512_loadu_pd
+#define vstore _mm512_storeu_pd
+#define vset1 _mm512_set1_pd
+#define vadd _mm512_add_pd
+#define vmul _mm512_mul_pd
+#define vmadd(x, y, acc) _mm512_fmadd_pd(x, y, acc)
+#define smadd(x, y, acc) fma(x, y, acc)
+
+#define KERNEL_VAR KERNEL_AVX512
+#define KERNEL_ISA KERNEL_ISA_AVX512
+#define KERNEL_NAME "avx512"
+#include "stencil/kernel_simd.h"
@@ -0,0 +1,17 @@
+#include <immintrin.h>
+
+// SSE2 variant, compiled with `-msse2`
+#define vec_t __m128d
+#define VLEN 2
+#define vload _mm_loadu_pd
+#define vstore _mm_storeu_pd
+#define vset1 _mm_set1_pd
+#define vadd _mm_add_pd
+#define vmul _mm_mul_pd
+#define vmadd(x, y, acc) _mm_add_pd(_mm_mul_pd(x, y), acc)
+#define smadd(x, y, acc) ((x) * (y) + (acc))
+
+#define KERNEL_VAR KERNEL_SSE2
+#define KERNEL_ISA KERNEL_ISA_SSE2
+#define KERNEL_NAME "sse2"
+#include "stencil/kernel_simd.h"
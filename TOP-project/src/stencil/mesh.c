@@ -1,72 +1,150 @@
 #include "stencil/mesh.h"
 
 #include "logging.h"
+#include "stencil/instrument.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include <linux/mempolicy.h>
 #include <omp.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
-mesh_t mesh_new(usz dim_x, usz dim_y, usz dim_z, mesh_kind_t kind) {
-    usz const ghost_size = 2 * STENCIL_ORDER;
+/// Number of elements in a row of `MESH_ALIGNMENT` bytes.
+#define ALIGN_ELEMS (MESH_ALIGNMENT / sizeof(f64))
+/// Number of elements in a 4 KiB page, strides multiple of it cause cache set conflicts.
+#define PAGE_ELEMS (4096UL / sizeof(f64))
+/// Size of a (PMD-level) huge page.
+#define HUGE_PAGE_SIZE (2UL << 20)
+/// Maximum number of NUMA nodes handled by the interleave policy.
+#define MAX_NUMA_NODES 1024UL
 
-    // Allocate memory for the outer array of pointers
-    cell_t*** cells = malloc((dim_x + ghost_size) * sizeof(cell_t**));
-    if (NULL == cells) {
-        error("failed to allocate dimension X of mesh of size %zu bytes", (dim_x + ghost_size) * sizeof(cell_t**));
-        return (mesh_t){0};  // Return an empty mesh on failure
+/// Pads a stride to the alignment and moves it away from multiples of the page size.
+static usz padded_stride(usz n) {
+    usz stride = round_up(n, ALIGN_ELEMS);
+    if (0 == stride % PAGE_ELEMS) {
+        stride += ALIGN_ELEMS;
     }
-    //#pragma omp parallel for  // parallel
-    for (usz i = 0; i < dim_x + ghost_size; ++i) {
-        cells[i] = malloc((dim_y + ghost_size) * sizeof(cell_t*));
-        if (NULL == cells[i]) {
-            error("failed to allocate dimension Y of mesh of size %zu bytes", (dim_y + ghost_size) * sizeof(cell_t*));
-            // Clean up previously allocated memory
-            for (usz k = 0; k < i; k++) {
-                free(cells[k]);
+    return stride;
+}
+
+/// Maps `size` bytes aligned on a huge page boundary and asks for them to be backed by THPs.
+static void* map_transparent_huge_pages(usz size) {
+    usz const mapped_size = size + HUGE_PAGE_SIZE;
+    u8* raw = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == raw) {
+        error("failed to map mesh of size %zu bytes", mapped_size);
+    }
+
+    // Trim the mapping so that it starts and ends on huge page boundaries
+    u8* start = (u8*)round_up((usz)raw, HUGE_PAGE_SIZE);
+    if (start != raw) {
+        munmap(raw, (usz)(start - raw));
+    }
+    usz const tail = mapped_size - (usz)(start - raw) - size;
+    if (0 != tail) {
+        munmap(start + size, tail);
+    }
+
+    if (0 != madvise(start, size, MADV_HUGEPAGE)) {
+        warn("failed to request transparent huge pages for mesh: %s", strerror(errno));
+    }
+    return start;
+}
+
+/// Maps the storage of a mesh. The size is updated to the actual size of the mapping.
+static void* map_pages(usz* size, mesh_pages_t pages) {
+    switch (pages) {
+        case MESH_PAGES_HUGETLB: {
+            usz const huge_size = round_up(*size, HUGE_PAGE_SIZE);
+            void* p = mmap(
+                NULL,
+                huge_size,
+                PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                -1,
+                0
+            );
+            if (MAP_FAILED != p) {
+                *size = huge_size;
+                return p;
             }
-            free(cells);
-            return (mesh_t){0};  // Return an empty mesh on failure
+            warn(
+                "failed to map %zu bytes of explicit huge pages (%s), falling back to THPs",
+                huge_size,
+                strerror(errno)
+            );
         }
-
-        //#pragma omp parallel for
-        for (usz j = 0; j < dim_y + ghost_size; ++j) {
-            cells[i][j] = malloc((dim_z + ghost_size) * sizeof(cell_t));
-            if (NULL == cells[i][j]) {
-                error("failed to allocate dimension Z of mesh of size %zu bytes", (dim_z + ghost_size) * sizeof(cell_t));
-                // Clean up previously allocated memory
-                for (usz k = 0; k <= i; k++) {
-                    for (usz l = 0; l < (k < i ? dim_y + ghost_size : j); l++) {
-                        free(cells[k][l]);
-                    }
-                    free(cells[k]);
-                }
-                free(cells);
-                return (mesh_t){0};  // Return an empty mesh on failure
+            // fall through
+        case MESH_PAGES_TRANSPARENT:
+            *size = round_up(*size, HUGE_PAGE_SIZE);
+            return map_transparent_huge_pages(*size);
+        case MESH_PAGES_DEFAULT: {
+            void* p = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (MAP_FAILED == p) {
+                error("failed to map mesh of size %zu bytes", *size);
             }
+            return p;
         }
+        default:
+            __builtin_unreachable();
     }
+}
 
+/// Interleaves the (not yet touched) pages of a mapping across the NUMA nodes allowed to us.
+static void interleave_pages(void* addr, usz size) {
+    unsigned long nodemask[MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = {0};
+    if (0 != syscall(
+                 SYS_get_mempolicy, NULL, nodemask, MAX_NUMA_NODES, NULL, MPOL_F_MEMS_ALLOWED
+             ) ||
+        0 != syscall(SYS_mbind, addr, size, MPOL_INTERLEAVE, nodemask, MAX_NUMA_NODES, 0))
+    {
+        warn("failed to interleave mesh pages, using local placement: %s", strerror(errno));
+    }
+}
+
+mesh_t mesh_layout(usz dim_x, usz dim_y, usz dim_z, usz order, usz depth, mesh_kind_t kind) {
+    assert(depth > 0);
+    usz const ghost_size = 2 * depth * order;
+
+    usz const stride_y = padded_stride(dim_z + ghost_size);
+    usz const stride_x = padded_stride((dim_y + ghost_size) * stride_y);
     return (mesh_t){
         .dim_x = dim_x + ghost_size,
         .dim_y = dim_y + ghost_size,
         .dim_z = dim_z + ghost_size,
-        .cells = cells,
+        .order = order,
+        .ghost = depth * order,
+        .stride_x = stride_x,
+        .stride_y = stride_y,
+        .values = NULL,
+        .size = round_up((dim_x + ghost_size) * stride_x * sizeof(f64), MESH_ALIGNMENT),
         .kind = kind,
     };
 }
 
+mesh_t mesh_new(
+    usz dim_x, usz dim_y, usz dim_z, usz order, usz depth, mesh_kind_t kind, mesh_alloc_t alloc
+) {
+    mesh_t self = mesh_layout(dim_x, dim_y, dim_z, order, depth, kind);
+
+    // Pages are mapped lazily, they are only placed when first touched by `init_meshes`
+    self.values = map_pages(&self.size, alloc.pages);
+    if (MESH_NUMA_INTERLEAVE == alloc.numa) {
+        interleave_pages(self.values, self.size);
+    }
+    return self;
+}
+
 void mesh_drop(mesh_t* self) {
-    if (NULL != self->cells) {
-        //#pragma omp parallel for collapse(2)
-        for (usz i = 0; i < self->dim_x; ++i) {
-            for (usz j = 0; j < self->dim_y; ++j) {
-		free(self->cells[i][j]);
-            }
-            free(self->cells[i]);
-        }
-        free(self->cells);
+    if (NULL != self->values) {
+        munmap(self->values, self->size);
     }
+    self->values = NULL;
 }
 
 static char const* mesh_kind_as_str(mesh_t const* self) {
@@ -74,6 +152,7 @@ static char const* mesh_kind_as_str(mesh_t const* self) {
         "CONSTANT",
         "INPUT",
         "OUTPUT",
+        "PRODUCT",
     };
     return MESH_KINDS_STR[(usz)self->kind];
 }
@@ -90,14 +169,13 @@ void mesh_print(mesh_t const* self, char const* name) {
         self->dim_z
     );
 
-    //#pragma omp parallel for collapse(2)
     for (usz i = 0; i < self->dim_x; ++i) {
         for (usz j = 0; j < self->dim_y; ++j) {
             for (usz k = 0; k < self->dim_z; ++k) {
                 printf(
                     "%s%6.3lf%s ",
-                    CELL_KIND_CORE == self->cells[i][j][k].kind ? "\x1b[1m" : "",
-                    self->cells[i][j][k].value,
+                    CELL_KIND_CORE == mesh_set_cell_kind(self, i, j, k) ? "\x1b[1m" : "",
+                    idx_const(self, i, j, k),
                     "\x1b[0m"
                 );
             }
@@ -108,9 +186,9 @@ void mesh_print(mesh_t const* self, char const* name) {
 }
 
 cell_kind_t mesh_set_cell_kind(mesh_t const* self, usz i, usz j, usz k) {
-    if ((i >= STENCIL_ORDER && i < self->dim_x - STENCIL_ORDER) &&
-        (j >= STENCIL_ORDER && j < self->dim_y - STENCIL_ORDER) &&
-        (k >= STENCIL_ORDER && k < self->dim_z - STENCIL_ORDER))
+    usz const o = self->ghost;
+    if ((i >= o && i < self->dim_x - o) && (j >= o && j < self->dim_y - o) &&
+        (k >= o && k < self->dim_z - o))
     {
         return CELL_KIND_CORE;
     } else {
@@ -122,14 +200,23 @@ void mesh_copy_core(mesh_t* dst, mesh_t const* src) {
     assert(dst->dim_x == src->dim_x);
     assert(dst->dim_y == src->dim_y);
     assert(dst->dim_z == src->dim_z);
-    #pragma omp parallel for collapse(3)  //parallel
-    for (usz k = STENCIL_ORDER; k < dst->dim_z - STENCIL_ORDER; ++k) {
-        for (usz j = STENCIL_ORDER; j < dst->dim_y - STENCIL_ORDER; ++j) {
-            for (usz i = STENCIL_ORDER; i < dst->dim_x - STENCIL_ORDER; ++i) {
-                assert(dst->cells[i][j][k].kind == CELL_KIND_CORE);
-                assert(src->cells[i][j][k].kind == CELL_KIND_CORE);
-                dst->cells[i][j][k].value = src->cells[i][j][k].value;
-            }
+    assert(dst->stride_x == src->stride_x && dst->stride_y == src->stride_y);
+    assert(dst->ghost == src->ghost);
+
+    usz const o = dst->ghost;
+    usz const row_len = (dst->dim_z - 2 * o) * sizeof(f64);
+    INSTRUMENT_SCOPE(INSTRUMENT_PHASE_COPY);
+    u64 nb_bytes = 0;
+    #pragma omp for collapse(2)
+    for (usz i = o; i < dst->dim_x - o; ++i) {
+        for (usz j = o; j < dst->dim_y - o; ++j) {
+            memcpy(
+                idx(dst, i, j, o),
+                src->values + mesh_offset(src, i, j, o),
+                row_len
+            );
+            nb_bytes += row_len;
         }
     }
+    INSTRUMENT_COUNT(INSTRUMENT_PHASE_COPY, INSTRUMENT_COUNTER_BYTES, nb_bytes);
 }
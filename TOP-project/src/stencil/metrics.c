@@ -0,0 +1,235 @@
+#include "stencil/metrics.h"
+#include "stencil/instrument.h"
+
+#include <stdlib.h>
+
+/// Tags of the messages forwarding center values are the first iteration of their batch, modulo
+/// the smallest upper bound guaranteed by MPI.
+#define METRICS_TAG_BOUND 32767
+
+metrics_t metrics_new(
+    MPI_Comm comm, usz dim_x, usz dim_y, usz dim_z, usz niter, usz batch, FILE* ofp
+) {
+    metrics_t self = {
+        .dim_x = dim_x,
+        .dim_y = dim_y,
+        .dim_z = dim_z,
+        .niter = niter,
+        .batch = batch,
+        .times = malloc(2 * niter * sizeof(f64)),
+        .centers = calloc(niter, sizeof(f64)),
+        .owns = calloc(niter, sizeof(bool)),
+        .ofp = ofp,
+    };
+    MPI_Comm_dup(comm, &self.comm);
+    MPI_Comm_rank(self.comm, &self.rank);
+    MPI_Comm_size(self.comm, &self.comm_size);
+
+    // A message holds the values of a batch, then whether the sender computed them
+    usz const max_batch = (0 == batch || batch > niter) ? niter : batch;
+    self.send_buf = malloc(2 * max_batch * sizeof(f64));
+    if (0 == self.rank) {
+        self.sums = malloc(2 * niter * sizeof(f64));
+        self.mins = malloc(2 * niter * sizeof(f64));
+        self.maxs = malloc(2 * niter * sizeof(f64));
+        self.recv_buf = malloc(2 * max_batch * sizeof(f64));
+    }
+    for (usz r = 0; r < 4; ++r) {
+        self.requests[r] = MPI_REQUEST_NULL;
+    }
+    return self;
+}
+
+/// Completes the aggregation of the batch in flight, and writes it from rank 0.
+static void complete_batch(metrics_t* self) {
+    usz const first = self->flight_first;
+    usz const nb = self->flight_last - first;
+    if (0 == nb) {
+        return;
+    }
+    MPI_Waitall(3, self->requests, MPI_STATUSES_IGNORE);
+
+    // Every iteration was computed by exactly one rank, whose message gives its center value
+    if (0 == self->rank) {
+        i32 const tag = (i32)(first % METRICS_TAG_BOUND);
+        for (usz nb_received = 0; nb_received < nb;) {
+            MPI_Recv(
+                self->recv_buf,
+                (i32)(2 * nb),
+                MPI_DOUBLE,
+                MPI_ANY_SOURCE,
+                tag,
+                self->comm,
+                MPI_STATUS_IGNORE
+            );
+            for (usz i = 0; i < nb; ++i) {
+                if (0.0 != self->recv_buf[nb + i]) {
+                    self->centers[first + i] = self->recv_buf[i];
+                    nb_received += 1;
+                }
+            }
+        }
+
+        f64 const nb_cells = (f64)self->dim_x * (f64)self->dim_y * (f64)self->dim_z;
+        for (usz it = first; it < first + nb; ++it) {
+            f64 const elapsed_s = self->sums[2 * it] / (f64)self->comm_size;
+            fprintf(
+                self->ofp,
+                "%+18.15lf %12.9lf %12.3lf %zu %zu %zu\n",
+                self->centers[it],
+                elapsed_s,
+                elapsed_s * 1e9 / nb_cells,
+                self->dim_x,
+                self->dim_y,
+                self->dim_z
+            );
+        }
+    }
+    MPI_Wait(&self->requests[3], MPI_STATUS_IGNORE);
+    self->flight_first = self->flight_last;
+}
+
+/// Starts the aggregation of the iterations recorded since the last batch, after completing it.
+static void start_batch(metrics_t* self) {
+    complete_batch(self);
+    usz const first = self->flight_last;
+    usz const nb = self->nb_recorded - first;
+    if (0 == nb) {
+        return;
+    }
+
+    // Results of the reductions are only significant on rank 0
+    f64 const* times = self->times + 2 * first;
+    i32 const count = (i32)(2 * nb);
+    f64* const results[3] = {self->sums, self->mins, self->maxs};
+    MPI_Op const ops[3] = {MPI_SUM, MPI_MIN, MPI_MAX};
+    for (usz r = 0; r < 3; ++r) {
+        MPI_Ireduce(
+            times,
+            (0 == self->rank) ? results[r] + 2 * first : NULL,
+            count,
+            MPI_DOUBLE,
+            ops[r],
+            0,
+            self->comm,
+            &self->requests[r]
+        );
+    }
+
+    // Only the ranks that computed the center cell during the batch forward its values
+    bool owns_any = false;
+    for (usz i = 0; i < nb; ++i) {
+        self->send_buf[i] = self->centers[first + i];
+        self->send_buf[nb + i] = self->owns[first + i] ? 1.0 : 0.0;
+        owns_any = owns_any || self->owns[first + i];
+    }
+    if (owns_any) {
+        MPI_Isend(
+            self->send_buf,
+            count,
+            MPI_DOUBLE,
+            0,
+            (i32)(first % METRICS_TAG_BOUND),
+            self->comm,
+            &self->requests[3]
+        );
+    }
+    self->flight_first = first;
+    self->flight_last = self->nb_recorded;
+}
+
+void metrics_record(metrics_t* self, f64 elapsed_s, f64 compute_s, bool owns, f64 center) {
+    INSTRUMENT_SCOPE(INSTRUMENT_PHASE_OUTPUT);
+    usz const it = self->nb_recorded;
+    if (it == self->niter) {
+        return;
+    }
+    self->times[2 * it] = elapsed_s;
+    self->times[2 * it + 1] = compute_s;
+    self->centers[it] = owns ? center : 0.0;
+    self->owns[it] = owns;
+    self->nb_recorded += 1;
+
+    if (0 != self->batch && 0 == self->nb_recorded % self->batch) {
+        start_batch(self);
+    }
+}
+
+void metrics_finish(metrics_t* self) {
+    INSTRUMENT_SCOPE(INSTRUMENT_PHASE_OUTPUT);
+    start_batch(self);
+    complete_batch(self);
+
+    // Totals of every rank
+    f64 totals[2] = {0.0, 0.0};
+    for (usz it = 0; it < self->nb_recorded; ++it) {
+        totals[0] += self->times[2 * it];
+        totals[1] += self->times[2 * it + 1];
+    }
+    f64* rank_totals = (0 == self->rank) ? malloc(2 * (usz)self->comm_size * sizeof(f64)) : NULL;
+    MPI_Gather(totals, 2, MPI_DOUBLE, rank_totals, 2, MPI_DOUBLE, 0, self->comm);
+    if (0 != self->rank || 0 == self->nb_recorded) {
+        free(rank_totals);
+        return;
+    }
+
+    f64 mean_s = 0.0;
+    f64 fastest_s = 0.0;
+    f64 slowest_s = 0.0;
+    for (usz it = 0; it < self->nb_recorded; ++it) {
+        mean_s += self->sums[2 * it] / (f64)self->comm_size;
+        fastest_s += self->mins[2 * it];
+        slowest_s += self->maxs[2 * it];
+    }
+    i32 min_rank = 0;
+    i32 max_rank = 0;
+    f64 mean_compute_s = 0.0;
+    for (i32 r = 0; r < self->comm_size; ++r) {
+        f64 const compute_s = rank_totals[2 * r + 1];
+        min_rank = (compute_s < rank_totals[2 * min_rank + 1]) ? r : min_rank;
+        max_rank = (compute_s > rank_totals[2 * max_rank + 1]) ? r : max_rank;
+        mean_compute_s += compute_s / (f64)self->comm_size;
+    }
+    f64 const nb = (f64)self->nb_recorded;
+    f64 const imbalance =
+        (mean_compute_s > 0.0) ? (rank_totals[2 * max_rank + 1] / mean_compute_s - 1.0) : 0.0;
+    fprintf(
+        stderr,
+        "****************************************\n"
+        "         ITERATION METRICS\n"
+        "Iterations ......................... %zu\n"
+        "Ranks .............................. %d\n"
+        "Iteration time (mean) .............. %.9lf s\n"
+        "Iteration time (fastest rank) ...... %.9lf s\n"
+        "Iteration time (slowest rank) ...... %.9lf s\n"
+        "Compute time per rank (min) ........ %.6lf s (rank %d)\n"
+        "Compute time per rank (mean) ....... %.6lf s\n"
+        "Compute time per rank (max) ........ %.6lf s (rank %d)\n"
+        "Load imbalance ..................... %.2lf %%\n",
+        self->nb_recorded,
+        self->comm_size,
+        mean_s / nb,
+        fastest_s / nb,
+        slowest_s / nb,
+        rank_totals[2 * min_rank + 1],
+        min_rank,
+        mean_compute_s,
+        rank_totals[2 * max_rank + 1],
+        max_rank,
+        imbalance * 100.0
+    );
+    free(rank_totals);
+}
+
+void metrics_drop(metrics_t* self) {
+    free(self->times);
+    free(self->sums);
+    free(self->mins);
+    free(self->maxs);
+    free(self->centers);
+    free(self->owns);
+    free(self->send_buf);
+    free(self->recv_buf);
+    MPI_Comm_free(&self->comm);
+    *self = (metrics_t){.comm = MPI_COMM_NULL};
+}
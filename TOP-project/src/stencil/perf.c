@@ -0,0 +1,230 @@
+#define _GNU_SOURCE
+
+#include "stencil/perf.h"
+#include "chrono.h"
+
+#include <linux/perf_event.h>
+#include <math.h>
+#include <omp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/// Elements of each array of the STREAM triad, far larger than the caches.
+#define PERF_STREAM_ELEMS (1UL << 22)
+/// Cache budget (in bytes) of each thread when measuring the kernel in cache, if the size of the
+/// L2 cannot be queried.
+#define PERF_CACHE_BYTES (256UL << 10)
+/// Number of runs of each measurement, the best one is kept.
+#define PERF_NB_RUNS 5
+/// Cell updates of each thread per run of the kernel in cache, over as many sweeps as needed.
+#define PERF_CACHE_UPDATES (1UL << 20)
+
+/// Opens an event of the calling thread in the group of `leader` (or as the leader if -1).
+static i32 open_event(u32 type, u64 config, i32 leader) {
+    struct perf_event_attr attr = {
+        .type = type,
+        .size = sizeof(struct perf_event_attr),
+        .config = config,
+        .read_format = PERF_FORMAT_GROUP,
+        .disabled = (leader < 0) ? 1 : 0,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+    };
+    return (i32)syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+}
+
+/// Returns the configuration of a generic cache event.
+static u64 cache_event(u64 cache, u64 op, u64 result) {
+    return cache | (op << 8) | (result << 16);
+}
+
+perf_group_t perf_group_open(void) {
+    struct {
+        u32 type;
+        u64 config;
+    } const events[PERF_NB_EVENTS] = {
+        [PERF_EVENT_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        [PERF_EVENT_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        [PERF_EVENT_LLC_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        [PERF_EVENT_MEMORY_READS] =
+            {
+                PERF_TYPE_HW_CACHE,
+                cache_event(
+                    PERF_COUNT_HW_CACHE_NODE,
+                    PERF_COUNT_HW_CACHE_OP_READ,
+                    PERF_COUNT_HW_CACHE_RESULT_ACCESS
+                ),
+            },
+        [PERF_EVENT_MEMORY_WRITES] =
+            {
+                PERF_TYPE_HW_CACHE,
+                cache_event(
+                    PERF_COUNT_HW_CACHE_NODE,
+                    PERF_COUNT_HW_CACHE_OP_WRITE,
+                    PERF_COUNT_HW_CACHE_RESULT_ACCESS
+                ),
+            },
+    };
+
+    perf_group_t self = {.leader = -1};
+    for (usz e = 0; e < PERF_NB_EVENTS; ++e) {
+        self.fds[e] = -1;
+        self.slots[e] = -1;
+    }
+    for (usz e = 0; e < PERF_NB_EVENTS; ++e) {
+        self.fds[e] = open_event(events[e].type, events[e].config, self.leader);
+        self.slots[e] = (self.fds[e] >= 0) ? self.nb_slots++ : -1;
+        if (PERF_EVENT_CYCLES == e) {
+            if (self.fds[e] < 0) {
+                return self;
+            }
+            self.leader = self.fds[e];
+        }
+    }
+    ioctl(self.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(self.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return self;
+}
+
+void perf_group_read(perf_group_t const* self, u64 values[static PERF_NB_EVENTS]) {
+    // The group reads as its number of events, then their counts in the order they were opened
+    u64 buf[1 + PERF_NB_EVENTS] = {0};
+    if (self->leader < 0 || read(self->leader, buf, sizeof(buf)) < 0) {
+        memset(values, 0, PERF_NB_EVENTS * sizeof(u64));
+        return;
+    }
+    for (usz e = 0; e < PERF_NB_EVENTS; ++e) {
+        values[e] = (self->slots[e] >= 0) ? buf[1 + self->slots[e]] : 0;
+    }
+}
+
+void perf_group_close(perf_group_t* self) {
+    for (usz e = 0; e < PERF_NB_EVENTS; ++e) {
+        if (self->fds[e] >= 0) {
+            close(self->fds[e]);
+        }
+    }
+    self->leader = -1;
+    for (usz e = 0; e < PERF_NB_EVENTS; ++e) {
+        self->fds[e] = -1;
+        self->slots[e] = -1;
+    }
+    self->nb_slots = 0;
+}
+
+/// Returns the bandwidth (in bytes per second) of a STREAM triad with `nb_threads` threads.
+static f64 stream_triad(usz nb_threads, MPI_Comm comm) {
+    f64* a = malloc(3 * PERF_STREAM_ELEMS * sizeof(f64));
+    f64* b = a + PERF_STREAM_ELEMS;
+    f64* c = b + PERF_STREAM_ELEMS;
+    f64 best = INFINITY;
+
+    #pragma omp parallel num_threads(nb_threads)
+    {
+        // First touch with the schedule of the triad
+        #pragma omp for schedule(static)
+        for (usz i = 0; i < PERF_STREAM_ELEMS; ++i) {
+            a[i] = 0.0;
+            b[i] = 1.0;
+            c[i] = 2.0;
+        }
+        for (usz r = 0; r < PERF_NB_RUNS; ++r) {
+            chrono_t chrono;
+            #pragma omp master
+            {
+                MPI_Barrier(comm);
+                chrono_start(&chrono);
+            }
+            #pragma omp barrier
+            #pragma omp for schedule(static)
+            for (usz i = 0; i < PERF_STREAM_ELEMS; ++i) {
+                a[i] = b[i] + 3.0 * c[i];
+            }
+            #pragma omp master
+            {
+                chrono_stop(&chrono);
+                f64 const elapsed = duration_as_s_f64(chrono_elapsed(chrono));
+                best = (elapsed < best) ? elapsed : best;
+            }
+        }
+    }
+    free(a);
+    // Reads of b and c and write of a, as counted by STREAM
+    return 3.0 * PERF_STREAM_ELEMS * sizeof(f64) / best;
+}
+
+/// Returns the edge (in cells) of the cubic core of the arrays of each thread when measuring the
+/// kernel of `order` in cache: the largest one for which the three arrays, with their ghost layers,
+/// fit the L2 of a core.
+static usz cache_dim(usz order) {
+    i64 const l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    usz const budget = (l2 > 0) ? (usz)l2 : PERF_CACHE_BYTES;
+    usz edge = 2 * order + 1;
+    while (3 * (edge + 1) * (edge + 1) * (edge + 1) * sizeof(f64) <= budget) {
+        edge += 1;
+    }
+    return edge - 2 * order;
+}
+
+/// Returns the throughput (in FLOP per second) of the kernel of `solver` with `nb_threads`
+/// threads, each sweeping its own arrays held in its L2 (see `cache_dim`).
+static f64 kernel_in_cache(solver_t const* solver, usz nb_threads) {
+    kernel_t const* kernel = solver->kernel;
+    usz const order = kernel->order;
+    usz const dim = cache_dim(order);
+    // Arrays are packed without the padding of the meshes, the rows are loaded unaligned anyway
+    usz const sy = dim + 2 * order;
+    usz const sx = sy * sy;
+    usz const nb_values = sy * sx;
+    usz const nb_sweeps = (PERF_CACHE_UPDATES + dim * dim * dim - 1) / (dim * dim * dim);
+    f64 best = INFINITY;
+
+    #pragma omp parallel num_threads(nb_threads)
+    {
+        // Allocated and touched by each thread, A and B hold the cells read and C the ones written
+        usz const size = round_up(3 * nb_values * sizeof(f64), PERF_CACHE_LINE);
+        f64* a = aligned_alloc(PERF_CACHE_LINE, size);
+        f64* b = a + nb_values;
+        f64* c = b + nb_values;
+        for (usz v = 0; v < nb_values; ++v) {
+            a[v] = 1.0;
+            b[v] = 0.5;
+            c[v] = 0.0;
+        }
+
+        for (usz r = 0; r < PERF_NB_RUNS; ++r) {
+            chrono_t chrono;
+            #pragma omp barrier
+            #pragma omp master
+            chrono_start(&chrono);
+            for (usz s = 0; s < nb_sweeps; ++s) {
+                for (usz i = order; i < order + dim; ++i) {
+                    for (usz j = order; j < order + dim; ++j) {
+                        kernel->row(a, b, c, i * sx + j * sy + order, dim, sx, sy);
+                    }
+                }
+            }
+            #pragma omp barrier
+            #pragma omp master
+            {
+                chrono_stop(&chrono);
+                f64 const elapsed = duration_as_s_f64(chrono_elapsed(chrono));
+                best = (elapsed < best) ? elapsed : best;
+            }
+        }
+        free(a);
+    }
+
+    f64 const nb_cells = (f64)nb_threads * (f64)nb_sweeps * (f64)(dim * dim * dim);
+    return nb_cells * (f64)perf_flops_per_cell(order) / best;
+}
+
+perf_ceilings_t perf_measure_ceilings(solver_t const* solver, usz nb_threads, MPI_Comm comm) {
+    return (perf_ceilings_t){
+        .bandwidth = stream_triad(nb_threads, comm),
+        .flops = kernel_in_cache(solver, nb_threads),
+    };
+}
@@ -0,0 +1,205 @@
+#include "stencil/snapshot.h"
+#include "logging.h"
+#include "stencil/instrument.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+bool snapshot_region_parse(char const val[static 1], snapshot_region_t* out) {
+    if (strcmp("all", val) == 0) {
+        *out = (snapshot_region_t){0};
+        return true;
+    }
+
+    usz bounds[6];
+    char const* cur = val;
+    for (usz b = 0; b < 6; ++b) {
+        char* end;
+        unsigned long long n = strtoull(cur, &end, 10);
+        if (end == cur || *end != ((5 == b) ? '\0' : ',')) {
+            return false;
+        }
+        bounds[b] = (usz)n;
+        cur = end + 1;
+    }
+    for (usz a = 0; a < 3; ++a) {
+        if (0 != bounds[3 + a] && bounds[3 + a] <= bounds[a]) {
+            return false;
+        }
+        out->lo[a] = bounds[a];
+        out->hi[a] = bounds[3 + a];
+    }
+    return true;
+}
+
+_Static_assert(
+    sizeof(snapshot_header_t) == SNAPSHOT_HEADER_SIZE, "snapshot header must fill its size"
+);
+
+/// Returns the number of cells of the local frame.
+static usz local_count(snapshot_t const* self) {
+    return self->counts[0] * self->counts[1] * self->counts[2];
+}
+
+snapshot_t snapshot_new(
+    comm_handler_t const* comm_handler,
+    char const path[static 1],
+    snapshot_region_t region,
+    usz step
+) {
+    usz const global_dims[3] = {comm_handler->dim_x, comm_handler->dim_y, comm_handler->dim_z};
+    snapshot_t self = {.header = {.step = step}};
+    memcpy(self.header.magic, SNAPSHOT_MAGIC, sizeof(self.header.magic));
+    for (usz a = 0; a < 3; ++a) {
+        usz const hi = (0 == region.hi[a] || region.hi[a] > global_dims[a]) ? global_dims[a]
+                                                                             : region.hi[a];
+        if (region.lo[a] >= hi) {
+            error("snapshot region is outside of the mesh along axis %zu", a);
+        }
+        self.header.global_dims[a] = global_dims[a];
+        self.header.origin[a] = region.lo[a];
+        self.header.dims[a] = (hi - region.lo[a] + step - 1) / step;
+    }
+
+    i32 rc = MPI_File_open(
+        comm_handler->comm,
+        path,
+        MPI_MODE_CREATE | MPI_MODE_WRONLY,
+        MPI_INFO_NULL,
+        &self.file
+    );
+    if (MPI_SUCCESS != rc) {
+        error("failed to open snapshot file %s", path);
+    }
+    MPI_File_set_size(self.file, 0);
+    for (usz b = 0; b < SNAPSHOT_NB_BUFFERS; ++b) {
+        self.requests[b] = MPI_REQUEST_NULL;
+    }
+    snapshot_resplit(&self, comm_handler);
+    return self;
+}
+
+void snapshot_resplit(snapshot_t* self, comm_handler_t const* comm_handler) {
+    MPI_Waitall(SNAPSHOT_NB_BUFFERS, self->requests, MPI_STATUSES_IGNORE);
+
+    // Sampled cells of the local mesh are the ones of the region a multiple of `step` past its
+    // origin
+    usz const step = self->header.step;
+    usz const coords[3] = {comm_handler->coord_x, comm_handler->coord_y, comm_handler->coord_z};
+    usz const loc_dims[3] = {
+        comm_handler->loc_dim_x,
+        comm_handler->loc_dim_y,
+        comm_handler->loc_dim_z,
+    };
+    for (usz a = 0; a < 3; ++a) {
+        usz const origin = self->header.origin[a];
+        usz const end = origin + (self->header.dims[a] - 1) * step + 1;
+        usz const lo = (coords[a] > origin) ? coords[a] : origin;
+        usz const hi = (coords[a] + loc_dims[a] < end) ? coords[a] + loc_dims[a] : end;
+        usz const frame_start = (lo - origin + step - 1) / step;
+        usz const first = origin + frame_start * step;
+        self->coords[a] = coords[a];
+        self->first[a] = first;
+        self->frame_starts[a] = frame_start;
+        self->counts[a] = (first < hi) ? (hi - first + step - 1) / step : 0;
+    }
+
+    // The view spans one frame, so that frames are consecutive tiles of it after the header
+    usz const count = local_count(self);
+    MPI_Datatype filetype = MPI_DOUBLE;
+    if (0 != count) {
+        i32 sizes[3];
+        i32 subsizes[3];
+        i32 starts[3];
+        for (usz a = 0; a < 3; ++a) {
+            sizes[a] = (i32)self->header.dims[a];
+            subsizes[a] = (i32)self->counts[a];
+            starts[a] = (i32)self->frame_starts[a];
+        }
+        MPI_Type_create_subarray(3, sizes, subsizes, starts, MPI_ORDER_C, MPI_DOUBLE, &filetype);
+        MPI_Type_commit(&filetype);
+    }
+    MPI_File_set_view(
+        self->file, SNAPSHOT_HEADER_SIZE, MPI_DOUBLE, filetype, "native", MPI_INFO_NULL
+    );
+    if (0 != count) {
+        MPI_Type_free(&filetype);
+    }
+
+    for (usz b = 0; b < SNAPSHOT_NB_BUFFERS; ++b) {
+        free(self->buffers[b]);
+        self->buffers[b] = malloc((0 == count ? 1 : count) * sizeof(f64));
+    }
+}
+
+void snapshot_write(snapshot_t* self, mesh_t const* mesh, usz iteration) {
+    INSTRUMENT_SCOPE(INSTRUMENT_PHASE_OUTPUT);
+    usz const frame = self->header.nb_frames;
+    usz const b = frame % SNAPSHOT_NB_BUFFERS;
+    MPI_Wait(&self->requests[b], MPI_STATUS_IGNORE);
+
+    usz const step = self->header.step;
+    usz const g = mesh->ghost;
+    f64* buf = self->buffers[b];
+    for (usz i = 0; i < self->counts[0]; ++i) {
+        usz const x = g + self->first[0] - self->coords[0] + i * step;
+        for (usz j = 0; j < self->counts[1]; ++j) {
+            usz const y = g + self->first[1] - self->coords[1] + j * step;
+            usz const z = g + self->first[2] - self->coords[2];
+            f64 const* row = mesh->values + mesh_offset(mesh, x, y, z);
+            for (usz k = 0; k < self->counts[2]; ++k) {
+                *buf++ = row[k * step];
+            }
+        }
+    }
+
+    // Offsets are in units of the view, a whole frame for each local block
+    usz const count = local_count(self);
+    INSTRUMENT_COUNT(INSTRUMENT_PHASE_OUTPUT, INSTRUMENT_COUNTER_BYTES, count * sizeof(f64));
+    MPI_File_iwrite_at_all(
+        self->file,
+        (MPI_Offset)(frame * count),
+        self->buffers[b],
+        (i32)count,
+        MPI_DOUBLE,
+        &self->requests[b]
+    );
+
+    if (self->capacity == frame) {
+        self->capacity = (0 == self->capacity) ? 64 : 2 * self->capacity;
+        self->iterations = realloc(self->iterations, self->capacity * sizeof(u64));
+    }
+    self->iterations[frame] = iteration;
+    self->header.nb_frames += 1;
+}
+
+void snapshot_drop(snapshot_t* self) {
+    MPI_Waitall(SNAPSHOT_NB_BUFFERS, self->requests, MPI_STATUSES_IGNORE);
+    MPI_File_set_view(self->file, 0, MPI_BYTE, MPI_BYTE, "native", MPI_INFO_NULL);
+
+    // The iterations of the frames follow the last one
+    i32 rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (0 == rank) {
+        usz const frame_size =
+            self->header.dims[0] * self->header.dims[1] * self->header.dims[2] * sizeof(f64);
+        MPI_File_write_at(
+            self->file, 0, &self->header, sizeof(self->header), MPI_BYTE, MPI_STATUS_IGNORE
+        );
+        MPI_File_write_at(
+            self->file,
+            (MPI_Offset)(SNAPSHOT_HEADER_SIZE + self->header.nb_frames * frame_size),
+            self->iterations,
+            (i32)(self->header.nb_frames * sizeof(u64)),
+            MPI_BYTE,
+            MPI_STATUS_IGNORE
+        );
+    }
+    MPI_File_close(&self->file);
+
+    for (usz b = 0; b < SNAPSHOT_NB_BUFFERS; ++b) {
+        free(self->buffers[b]);
+    }
+    free(self->iterations);
+    *self = (snapshot_t){.file = MPI_FILE_NULL};
+}
@@ -1,63 +1,498 @@
 #include "stencil/solve.h"
 
+#include "logging.h"
+#include "stencil/instrument.h"
+
 #include <assert.h>
-#include <math.h>
+#include <stdlib.h>
 #include <omp.h> // Inclusion de la bibliothèque OpenMP
 
-#define BLOCK_SIZE_I 32   // Taille de bloc pour s'adapter à la mémoire cache L1 
-#define BLOCK_SIZE_J 256  // Taille de bloc pour s'adapter à la mémoire cache L2 
-#define BLOCK_SIZE_K 4    // Taille de bloc pour s'adapter à la mémoire cache L3
+solver_t solver_new(kernel_isa_t isa, usz order, solve_tile_t tile) {
+    assert(tile.x > 0 && tile.y > 0 && tile.z > 0);
+    return (solver_t){
+        .kernel = kernel_select(isa, order),
+        .tile = tile,
+    };
+}
+
+/// Box of cells `[lo_x, hi_x) x [lo_y, hi_y) x [lo_z, hi_z)` of a mesh.
+typedef struct box_s {
+    usz lo_x;
+    usz hi_x;
+    usz lo_y;
+    usz hi_y;
+    usz lo_z;
+    usz hi_z;
+} box_t;
+
+static inline usz min_usz(usz a, usz b) {
+    return (a < b) ? a : b;
+}
+
+static inline usz max_usz(usz a, usz b) {
+    return (a > b) ? a : b;
+}
+
+static box_t core_box(mesh_t const* mesh) {
+    usz const ghost = mesh->ghost;
+    return (box_t){
+        .lo_x = ghost,
+        .hi_x = mesh->dim_x - ghost,
+        .lo_y = ghost,
+        .hi_y = mesh->dim_y - ghost,
+        .lo_z = ghost,
+        .hi_z = mesh->dim_z - ghost,
+    };
+}
+
+/// Splits the core of `mesh` into its shell as deep as the ghost layers (the cells sent to the
+/// neighbors), as six disjoint boxes, and the interior, which is returned. Boxes are empty along
+/// axes where the core is too thin to have an interior.
+static box_t split_core(mesh_t const* mesh, box_t shell[static 6]) {
+    usz const ghost = mesh->ghost;
+    box_t const core = core_box(mesh);
+    box_t const in = {
+        .lo_x = min_usz(core.lo_x + ghost, core.hi_x),
+        .hi_x = max_usz(core.hi_x - ghost, min_usz(core.lo_x + ghost, core.hi_x)),
+        .lo_y = min_usz(core.lo_y + ghost, core.hi_y),
+        .hi_y = max_usz(core.hi_y - ghost, min_usz(core.lo_y + ghost, core.hi_y)),
+        .lo_z = min_usz(core.lo_z + ghost, core.hi_z),
+        .hi_z = max_usz(core.hi_z - ghost, min_usz(core.lo_z + ghost, core.hi_z)),
+    };
+
+    // X faces span the whole core, Y faces the interior along X and Z faces the interior along X
+    // and Y
+    shell[0] = (box_t){core.lo_x, in.lo_x, core.lo_y, core.hi_y, core.lo_z, core.hi_z};
+    shell[1] = (box_t){in.hi_x, core.hi_x, core.lo_y, core.hi_y, core.lo_z, core.hi_z};
+    shell[2] = (box_t){in.lo_x, in.hi_x, core.lo_y, in.lo_y, core.lo_z, core.hi_z};
+    shell[3] = (box_t){in.lo_x, in.hi_x, in.hi_y, core.hi_y, core.lo_z, core.hi_z};
+    shell[4] = (box_t){in.lo_x, in.hi_x, in.lo_y, in.hi_y, core.lo_z, in.lo_z};
+    shell[5] = (box_t){in.lo_x, in.hi_x, in.lo_y, in.hi_y, in.hi_z, core.hi_z};
+    return in;
+}
+
+/// Computes the cells of `box` of C=B@A, tiles are shared among threads without a barrier.
+static void jacobi_box(
+    solver_t const* self, mesh_t const* A, mesh_t const* B, mesh_t* C, box_t box
+) {
+    usz const sx = A->stride_x;
+    usz const sy = A->stride_y;
+    solve_tile_t const tile = self->tile;
+    kernel_row_fn* const row = self->kernel->row;
+    INSTRUMENT_SCOPE(INSTRUMENT_PHASE_SOLVE);
+    u64 nb_cells = 0;
+
+    #pragma omp for collapse(3) schedule(static) nowait
+    for (usz i = box.lo_x; i < box.hi_x; i += tile.x) {
+        for (usz j = box.lo_y; j < box.hi_y; j += tile.y) {
+            for (usz k = box.lo_z; k < box.hi_z; k += tile.z) {
+                INSTRUMENT_TILE();
+                usz const k_end = min_usz(k + tile.z, box.hi_z);
+                for (usz bi = i; bi < i + tile.x && bi < box.hi_x; ++bi) {
+                    for (usz bj = j; bj < j + tile.y && bj < box.hi_y; ++bj) {
+                        row(
+                            A->values,
+                            B->values,
+                            C->values,
+                            bi * sx + bj * sy + k,
+                            k_end - k,
+                            sx,
+                            sy
+                        );
+                        nb_cells += k_end - k;
+                    }
+                }
+            }
+        }
+    }
+    INSTRUMENT_COUNT(INSTRUMENT_PHASE_SOLVE, INSTRUMENT_COUNTER_CELLS, nb_cells);
+}
+
+/// Computes the cells of `box` of C=B@A from the product P=A*B, tiles are shared among threads
+/// without a barrier.
+static void jacobi_product_box(solver_t const* self, mesh_t const* P, mesh_t* C, box_t box) {
+    usz const sx = P->stride_x;
+    usz const sy = P->stride_y;
+    solve_tile_t const tile = self->tile;
+    kernel_product_row_fn* const row = self->kernel->product_row;
+    INSTRUMENT_SCOPE(INSTRUMENT_PHASE_SOLVE);
+    u64 nb_cells = 0;
+
+    #pragma omp for collapse(3) schedule(static) nowait
+    for (usz i = box.lo_x; i < box.hi_x; i += tile.x) {
+        for (usz j = box.lo_y; j < box.hi_y; j += tile.y) {
+            for (usz k = box.lo_z; k < box.hi_z; k += tile.z) {
+                INSTRUMENT_TILE();
+                usz const k_end = min_usz(k + tile.z, box.hi_z);
+                for (usz bi = i; bi < i + tile.x && bi < box.hi_x; ++bi) {
+                    for (usz bj = j; bj < j + tile.y && bj < box.hi_y; ++bj) {
+                        row(P->values, C->values, bi * sx + bj * sy + k, k_end - k, sx, sy);
+                        nb_cells += k_end - k;
+                    }
+                }
+            }
+        }
+    }
+    INSTRUMENT_COUNT(INSTRUMENT_PHASE_SOLVE, INSTRUMENT_COUNTER_CELLS, nb_cells);
+}
+
+void solve_jacobi(solver_t const* self, mesh_t const* A, mesh_t const* B, mesh_t* C) {
+    assert(A->dim_x == B->dim_x && B->dim_x == C->dim_x);
+    assert(A->dim_y == B->dim_y && B->dim_y == C->dim_y);
+    assert(A->dim_z == B->dim_z && B->dim_z == C->dim_z);
+    assert(A->stride_x == B->stride_x && B->stride_x == C->stride_x);
+    assert(A->stride_y == B->stride_y && B->stride_y == C->stride_y);
+    assert(A->order == self->kernel->order && B->order == A->order && C->order == A->order);
+
+    jacobi_box(self, A, B, C, core_box(A));
+    instrument_barrier();
+}
 
-void solve_jacobi(mesh_t* A, mesh_t const* B, mesh_t* C) {
+void solve_jacobi_extended(
+    solver_t const* self, mesh_t const* A, mesh_t const* B, mesh_t* C, usz const extents[static 6]
+) {
     assert(A->dim_x == B->dim_x && B->dim_x == C->dim_x);
     assert(A->dim_y == B->dim_y && B->dim_y == C->dim_y);
     assert(A->dim_z == B->dim_z && B->dim_z == C->dim_z);
+    assert(A->stride_x == B->stride_x && B->stride_x == C->stride_x);
+    assert(A->stride_y == B->stride_y && B->stride_y == C->stride_y);
+    assert(A->order == self->kernel->order && B->order == A->order && C->order == A->order);
+    for (usz n = 0; n < 6; ++n) {
+        assert(extents[n] + A->order <= A->ghost);
+    }
+
+    box_t const core = core_box(A);
+    box_t const box = {
+        .lo_x = core.lo_x - extents[0],
+        .hi_x = core.hi_x + extents[1],
+        .lo_y = core.lo_y - extents[2],
+        .hi_y = core.hi_y + extents[3],
+        .lo_z = core.lo_z - extents[4],
+        .hi_z = core.hi_z + extents[5],
+    };
+    jacobi_box(self, A, B, C, box);
+    instrument_barrier();
+}
 
+static void product_row(
+    f64 const* restrict a, f64 const* restrict b, f64* restrict p, usz row, usz k_start, usz k_end
+) {
+    for (usz k = k_start; k < k_end; ++k) {
+        p[row + k] = a[row + k] * b[row + k];
+    }
+}
+
+/// Computes `P = A * B` in the calling thread's share of `P`, without waiting for the team.
+static void product(solver_t const* self, mesh_t const* A, mesh_t const* B, mesh_t* P) {
+    assert(A->dim_x == B->dim_x && B->dim_x == P->dim_x);
+    assert(A->dim_y == B->dim_y && B->dim_y == P->dim_y);
+    assert(A->dim_z == B->dim_z && B->dim_z == P->dim_z);
+    assert(A->stride_x == B->stride_x && B->stride_x == P->stride_x);
+    assert(A->stride_y == B->stride_y && B->stride_y == P->stride_y);
+    assert(B->order == A->order && P->order == A->order);
+
+    usz const ghost = A->ghost;
     usz const dim_x = A->dim_x;
     usz const dim_y = A->dim_y;
     usz const dim_z = A->dim_z;
-    usz i, j, k, o, bi, bj, bk;
-
-    // Precompute powers of 17
-    double precomputed_powers[STENCIL_ORDER + 1];
-    for (int i = 1; i <= STENCIL_ORDER; i++) {
-        precomputed_powers[i] = pow(17.0, (double)i);
-    }
-
-    // Fix the number of threads to 24 using OpenMP
-    
-    //omp_set_num_threads(1);
-    //omp_set_num_threads(2);
-    //omp_set_num_threads(4);
-    //omp_set_num_threads(8);
-    //omp_set_num_threads(16);
-    //omp_set_num_threads(24);
-    omp_set_num_threads(48);
-
-    #pragma omp parallel for private(i, j, k, bi, bj, bk, o) collapse(3) schedule(dynamic)
-    for (k = STENCIL_ORDER; k < dim_z - STENCIL_ORDER; k += BLOCK_SIZE_K) {
-        for (j = STENCIL_ORDER; j < dim_y - STENCIL_ORDER; j += BLOCK_SIZE_J) {
-            for (i = STENCIL_ORDER; i < dim_x - STENCIL_ORDER; i += BLOCK_SIZE_I) {
-                for (bk = k; bk < k + BLOCK_SIZE_K && bk < dim_z - STENCIL_ORDER; ++bk) {
-                    for (bj = j; bj < j + BLOCK_SIZE_J && bj < dim_y - STENCIL_ORDER; ++bj) {
-                        for (bi = i; bi < i + BLOCK_SIZE_I && bi < dim_x - STENCIL_ORDER; ++bi) {
-                            f64 sum = A->cells[bi][bj][bk].value * B->cells[bi][bj][bk].value;
-                            for (o = 1; o <= STENCIL_ORDER; ++o) {
-                                sum += ((A->cells[bi + o][bj][bk].value * B->cells[bi + o][bj][bk].value) 
-                                     + (A->cells[bi - o][bj][bk].value * B->cells[bi - o][bj][bk].value) 
-                                     + (A->cells[bi][bj + o][bk].value * B->cells[bi][bj + o][bk].value) 
-                                     + (A->cells[bi][bj - o][bk].value * B->cells[bi][bj - o][bk].value) 
-                                     + (A->cells[bi][bj][bk + o].value * B->cells[bi][bj][bk + o].value) 
-                                     + (A->cells[bi][bj][bk - o].value * B->cells[bi][bj][bk - o].value)) 
-                                     / precomputed_powers[o]; 
+    usz const sx = A->stride_x;
+    usz const sy = A->stride_y;
+    f64 const* restrict a = A->values;
+    f64 const* restrict b = B->values;
+    f64* restrict p = P->values;
+    solve_tile_t const tile = self->tile;
+    INSTRUMENT_SCOPE(INSTRUMENT_PHASE_SOLVE);
+
+    // Core, with the same tiles and schedule as the stencil sweep
+    #pragma omp for collapse(3) schedule(static) nowait
+    for (usz i = ghost; i < dim_x - ghost; i += tile.x) {
+        for (usz j = ghost; j < dim_y - ghost; j += tile.y) {
+            for (usz k = ghost; k < dim_z - ghost; k += tile.z) {
+                usz const k_end =
+                    (k + tile.z < dim_z - ghost) ? k + tile.z : dim_z - ghost;
+                for (usz bi = i; bi < i + tile.x && bi < dim_x - ghost; ++bi) {
+                    for (usz bj = j; bj < j + tile.y && bj < dim_y - ghost; ++bj) {
+                        product_row(a, b, p, bi * sx + bj * sy, k, k_end);
+                    }
+                }
+            }
+        }
+    }
+
+    // Ghost faces, edges and corners of the ghost shell are never read by the stencil
+    #pragma omp for collapse(2) schedule(static) nowait
+    for (usz i = 0; i < dim_x; ++i) {
+        for (usz j = 0; j < dim_y; ++j) {
+            bool const core_i = i >= ghost && i < dim_x - ghost;
+            bool const core_j = j >= ghost && j < dim_y - ghost;
+            usz const row = i * sx + j * sy;
+            if (core_i && core_j) {
+                product_row(a, b, p, row, 0, ghost);
+                product_row(a, b, p, row, dim_z - ghost, dim_z);
+            } else if (core_i || core_j) {
+                product_row(a, b, p, row, ghost, dim_z - ghost);
+            }
+        }
+    }
+}
+
+void solve_product(solver_t const* self, mesh_t const* A, mesh_t const* B, mesh_t* P) {
+    product(self, A, B, P);
+    instrument_barrier();
+}
+
+void solve_jacobi_product(solver_t const* self, mesh_t const* P, mesh_t* C) {
+    assert(P->dim_x == C->dim_x && P->dim_y == C->dim_y && P->dim_z == C->dim_z);
+    assert(P->stride_x == C->stride_x && P->stride_y == C->stride_y);
+    assert(P->order == self->kernel->order && C->order == P->order);
+
+    jacobi_product_box(self, P, C, core_box(P));
+    instrument_barrier();
+}
+
+void solve_jacobi_overlap(
+    solver_t const* self,
+    mesh_t const* A,
+    mesh_t const* B,
+    mesh_t* C,
+    mesh_t* P,
+    comm_handler_t* comm_handler
+) {
+    assert(A->dim_x == B->dim_x && B->dim_x == C->dim_x);
+    assert(A->dim_y == B->dim_y && B->dim_y == C->dim_y);
+    assert(A->dim_z == B->dim_z && B->dim_z == C->dim_z);
+    assert(A->stride_x == B->stride_x && B->stride_x == C->stride_x);
+    assert(A->stride_y == B->stride_y && B->stride_y == C->stride_y);
+    assert(A->order == self->kernel->order && B->order == A->order && C->order == A->order);
+
+    box_t shell[6];
+    box_t const interior = split_core(C, shell);
+    if (NULL != P) {
+        solve_product(self, A, B, P);
+    }
+
+    for (usz s = 0; s < 6; ++s) {
+        if (NULL != P) {
+            jacobi_product_box(self, P, C, shell[s]);
+        } else {
+            jacobi_box(self, A, B, C, shell[s]);
+        }
+    }
+    // The whole shell is computed before it is sent, the interior while it is in flight
+    instrument_barrier();
+    #pragma omp master
+    comm_handler_ghost_start(comm_handler, C);
+
+    if (NULL != P) {
+        jacobi_product_box(self, P, C, interior);
+    } else {
+        jacobi_box(self, A, B, C, interior);
+    }
+    instrument_barrier();
+}
+
+/// Y stride of the planes of the ring of `solve_jacobi_streaming` at `order`, keeps their rows
+/// aligned.
+static inline usz ring_stride_y(usz order) {
+    return round_up(STREAM_TILE_Z + 2 * order, MESH_ALIGNMENT / sizeof(f64));
+}
+
+/// Size (in elements) of a plane of the ring of `solve_jacobi_streaming` at `order`.
+static inline usz ring_plane_size(usz order) {
+    return (STREAM_TILE_Y + 2 * order) * ring_stride_y(order);
+}
+
+/// Size (in bytes) of the ring of `solve_jacobi_streaming` at the highest order, an upper bound.
+#define RING_MAX_BYTES                                                                             \
+    ((2 * STENCIL_MAX_ORDER + 1) * (STREAM_TILE_Y + 2 * STENCIL_MAX_ORDER) *                       \
+     (STREAM_TILE_Z + 2 * STENCIL_MAX_ORDER + MESH_ALIGNMENT / sizeof(f64)) * sizeof(f64))
+static_assert(
+    RING_MAX_BYTES <= STREAM_RING_BYTES,
+    "the ring of the streaming sweep does not fit its cache budget at the highest order"
+);
+
+/// Loads the product A*B of the Y/Z tile `[y0, y1) x [z0, z1)` of plane `x`, and the part of its
+/// ghost cells read by the stencil, into a plane of the ring.
+static void load_product_plane(
+    mesh_t const* A, mesh_t const* B, usz x, usz y0, usz y1, usz z0, usz z1, f64* restrict plane
+) {
+    f64 const* restrict a = A->values;
+    f64 const* restrict b = B->values;
+    usz const order = A->order;
+    for (usz j = y0 - order; j < y1 + order; ++j) {
+        // Edges of the ghost region are never read
+        bool const core_row = j >= y0 && j < y1;
+        usz const k_start = core_row ? z0 - order : z0;
+        usz const k_end = core_row ? z1 + order : z1;
+        usz const src = mesh_offset(A, x, j, 0);
+        usz const dst = (j - y0 + order) * ring_stride_y(order) - (z0 - order);
+        for (usz k = k_start; k < k_end; ++k) {
+            plane[dst + k] = a[src + k] * b[src + k];
+        }
+    }
+}
+
+void solve_jacobi_streaming(solver_t const* self, mesh_t const* A, mesh_t const* B, mesh_t* C) {
+    assert(A->dim_x == B->dim_x && B->dim_x == C->dim_x);
+    assert(A->dim_y == B->dim_y && B->dim_y == C->dim_y);
+    assert(A->dim_z == B->dim_z && B->dim_z == C->dim_z);
+    assert(A->stride_x == B->stride_x && B->stride_x == C->stride_x);
+    assert(A->stride_y == B->stride_y && B->stride_y == C->stride_y);
+    assert(A->order == self->kernel->order && B->order == A->order && C->order == A->order);
+
+    assert(A->ghost == A->order);
+
+    usz const order = A->order;
+    usz const nb_planes = 2 * order + 1;
+    usz const dim_x = A->dim_x;
+    usz const hi_y = A->dim_y - order;
+    usz const hi_z = A->dim_z - order;
+    usz const stride_y = ring_stride_y(order);
+    usz const plane_size = ring_plane_size(order);
+    kernel_ring_row_fn* const ring_row = self->kernel->ring_row;
+    INSTRUMENT_SCOPE(INSTRUMENT_PHASE_SOLVE);
+    u64 nb_cells = 0;
+
+    // Every thread of the team keeps its own ring
+    {
+        usz const ring_size = nb_planes * plane_size * sizeof(f64);
+        f64* ring = aligned_alloc(MESH_ALIGNMENT, ring_size);
+        if (NULL == ring) {
+            error("failed to allocate streaming ring of %zu planes", nb_planes);
+        }
+
+        #pragma omp for collapse(2) schedule(static)
+        for (usz y0 = order; y0 < hi_y; y0 += STREAM_TILE_Y) {
+            for (usz z0 = order; z0 < hi_z; z0 += STREAM_TILE_Z) {
+                INSTRUMENT_TILE();
+                usz const y1 = (y0 + STREAM_TILE_Y < hi_y) ? y0 + STREAM_TILE_Y : hi_y;
+                usz const z1 = (z0 + STREAM_TILE_Z < hi_z) ? z0 + STREAM_TILE_Z : hi_z;
+
+                for (usz x_load = 0; x_load < dim_x; ++x_load) {
+                    f64* plane = ring + (x_load % nb_planes) * plane_size;
+                    load_product_plane(A, B, x_load, y0, y1, z0, z1, plane);
+                    // Wait for the ring to hold all the planes around the first core plane
+                    if (x_load < 2 * order) {
+                        continue;
+                    }
+
+                    usz const x = x_load - order;
+                    f64 const* planes[KERNEL_NB_PLANES];
+                    for (usz o = 0; o < nb_planes; ++o) {
+                        usz const slot = (x - order + o) % nb_planes;
+                        planes[o] = ring + slot * plane_size;
+                    }
+                    for (usz j = y0; j < y1; ++j) {
+                        ring_row(
+                            planes,
+                            idx(C, x, j, z0),
+                            (j - y0 + order) * stride_y + order,
+                            z1 - z0,
+                            stride_y
+                        );
+                        nb_cells += z1 - z0;
+                    }
+                }
+            }
+        }
+
+        free(ring);
+    }
+    INSTRUMENT_COUNT(INSTRUMENT_PHASE_SOLVE, INSTRUMENT_COUNTER_CELLS, nb_cells);
+}
+
+static_assert(TIME_TILE_X >= 2 * STENCIL_MAX_ORDER, "temporal tiles are too small for their skew");
+static_assert(TIME_TILE_Y >= 2 * STENCIL_MAX_ORDER, "temporal tiles are too small for their skew");
+
+static inline usz clamp(isz n, usz lo, usz hi) {
+    return (n < (isz)lo) ? lo : ((n > (isz)hi) ? hi : (usz)n);
+}
+
+/// Returns the range covered by tile `t` at step `s` (0-based) along an axis of core `[lo, hi)`.
+static inline void skewed_range(
+    usz lo, usz hi, usz tile, usz order, usz t, usz s, usz* start, usz* end
+) {
+    // Tiles are shifted toward the origin by `order` cells at every step, so that the
+    // cells a tile reads at step `s` were all computed at step `s - 1` by itself or by tiles that
+    // precede it, and none of them is overwritten at step `s + 1` before it is read
+    isz const first = (isz)(lo + t * tile) - (isz)(s * order);
+    *start = clamp(first, lo, hi);
+    *end = clamp(first + (isz)tile, lo, hi);
+}
+
+void solve_jacobi_temporal(
+    solver_t const* self, mesh_t* A, mesh_t const* B, mesh_t* C, usz steps, solve_probe_t* probe
+) {
+    assert(A->dim_x == B->dim_x && B->dim_x == C->dim_x);
+    assert(A->dim_y == B->dim_y && B->dim_y == C->dim_y);
+    assert(A->dim_z == B->dim_z && B->dim_z == C->dim_z);
+    assert(A->stride_x == B->stride_x && B->stride_x == C->stride_x);
+    assert(A->stride_y == B->stride_y && B->stride_y == C->stride_y);
+    assert(A->order == self->kernel->order && B->order == A->order && C->order == A->order);
+
+    assert(A->ghost == A->order);
+
+    usz const order = A->order;
+    usz const hi_x = A->dim_x - order;
+    usz const hi_y = A->dim_y - order;
+    usz const len_z = A->dim_z - 2 * order;
+    usz const sx = A->stride_x;
+    usz const sy = A->stride_y;
+    kernel_row_fn* const row = self->kernel->row;
+    f64 const* b = B->values;
+    // Step `s` reads `bufs[s % 2]` and writes `bufs[(s + 1) % 2]`
+    f64* bufs[2] = {A->values, C->values};
+    INSTRUMENT_SCOPE(INSTRUMENT_PHASE_SOLVE);
+    u64 nb_cells = 0;
+
+    // Enough tiles for the last step, the most shifted one, to reach the end of the core
+    usz const skew = (steps - 1) * order;
+    usz const nb_tiles_x = (hi_x - order + skew + TIME_TILE_X - 1) / TIME_TILE_X;
+    usz const nb_tiles_y = (hi_y - order + skew + TIME_TILE_Y - 1) / TIME_TILE_Y;
+
+    for (usz ty = 0; ty < nb_tiles_y; ++ty) {
+        for (usz tx = 0; tx < nb_tiles_x; ++tx) {
+            for (usz s = 0; s < steps; ++s) {
+                usz x_start, x_end, y_start, y_end;
+                skewed_range(order, hi_x, TIME_TILE_X, order, tx, s, &x_start, &x_end);
+                skewed_range(order, hi_y, TIME_TILE_Y, order, ty, s, &y_start, &y_end);
+                f64 const* a = bufs[s % 2];
+                f64* c = bufs[(s + 1) % 2];
+
+                {
+                    INSTRUMENT_TILE();
+                    #pragma omp for collapse(2) schedule(static) nowait
+                    for (usz i = x_start; i < x_end; ++i) {
+                        for (usz j = y_start; j < y_end; ++j) {
+                            usz const q = i * sx + j * sy + order;
+                            row(a, b, c, q, len_z, sx, sy);
+                            nb_cells += len_z;
+                            if (probe->active && i == probe->i && j == probe->j) {
+                                probe->values[s] = c[q - order + probe->k];
                             }
-                            C->cells[bi][bj][bk].value = sum;
                         }
                     }
                 }
+                // Step `s + 1` of the tile depends on all of step `s`
+                #pragma omp barrier
             }
         }
     }
+    INSTRUMENT_COUNT(INSTRUMENT_PHASE_SOLVE, INSTRUMENT_COUNTER_CELLS, nb_cells);
+}
 
-    mesh_copy_core(A, C);
+void solve_commit(mesh_t** A, mesh_t** C, solve_buffering_t buffering) {
+    switch (buffering) {
+        case SOLVE_BUFFERING_SWAP: {
+            mesh_t* tmp = *A;
+            *A = *C;
+            *C = tmp;
+            break;
+        }
+        case SOLVE_BUFFERING_COPY:
+            mesh_copy_core(*A, *C);
+            break;
+        default:
+            __builtin_unreachable();
+    }
 }
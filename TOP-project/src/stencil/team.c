@@ -0,0 +1,167 @@
+#define _GNU_SOURCE
+
+#include "stencil/team.h"
+
+#include "logging.h"
+
+#include <errno.h>
+#include <omp.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+
+team_t team_new(usz nb_threads, team_affinity_t affinity, bool progress, MPI_Comm comm) {
+    i32 rank;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm node_comm;
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node_comm);
+    i32 node_rank;
+    MPI_Comm_rank(node_comm, &node_rank);
+    i32 node_size;
+    MPI_Comm_size(node_comm, &node_size);
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (0 != sched_getaffinity(0, sizeof(allowed), &allowed)) {
+        warn("failed to get the CPUs of rank %d: %s", rank, strerror(errno));
+        CPU_SET(0, &allowed);
+    }
+
+    // Ranks with the same CPUs share them, whether the launcher bound them (e.g. to a socket) or not
+    cpu_set_t* node_allowed = malloc((usz)node_size * sizeof(cpu_set_t));
+    MPI_Allgather(
+        &allowed, sizeof(cpu_set_t), MPI_BYTE, node_allowed, sizeof(cpu_set_t), MPI_BYTE, node_comm
+    );
+    usz nb_sharing = 0;
+    usz share = 0;
+    for (i32 r = 0; r < node_size; ++r) {
+        if (CPU_EQUAL(&allowed, &node_allowed[r])) {
+            share += (r < node_rank) ? 1 : 0;
+            nb_sharing += 1;
+        }
+    }
+    free(node_allowed);
+    MPI_Comm_free(&node_comm);
+
+    // Contiguous slice of the allowed CPUs, at least one (shared) if there are more ranks than CPUs
+    usz const nb_allowed = (usz)CPU_COUNT(&allowed);
+    usz first = share * nb_allowed / nb_sharing;
+    usz last = (share + 1) * nb_allowed / nb_sharing;
+    if (first == last) {
+        first %= nb_allowed;
+        last = first + 1;
+    }
+
+    team_t self = {
+        .affinity = affinity,
+        .nb_cpus = last - first,
+        .cpus = malloc((last - first) * sizeof(i32)),
+        .progress_cpu = -1,
+        .node_rank = node_rank,
+        .node_size = node_size,
+    };
+    for (usz cpu = 0, n = 0; cpu < CPU_SETSIZE && n < last; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            if (n >= first) {
+                self.cpus[n - first] = (i32)cpu;
+            }
+            n += 1;
+        }
+    }
+
+    // The progress thread gets the last CPU to itself, unless it is the only one
+    if (progress) {
+        if (TEAM_AFFINITY_NONE != affinity) {
+            self.progress_cpu = self.cpus[self.nb_cpus - 1];
+        }
+        if (self.nb_cpus > 1) {
+            self.nb_cpus -= 1;
+        } else {
+            warn("rank %d has a single CPU, the progress thread shares it with the team", rank);
+        }
+    }
+
+    if (0 != nb_threads) {
+        self.nb_threads = nb_threads;
+    } else if (NULL != getenv("OMP_NUM_THREADS")) {
+        self.nb_threads = (usz)omp_get_max_threads();
+    } else {
+        self.nb_threads = self.nb_cpus;
+    }
+    if (self.nb_threads > self.nb_cpus) {
+        warn(
+            "rank %d runs %zu threads on %zu CPUs, they are oversubscribed",
+            rank,
+            self.nb_threads,
+            self.nb_cpus
+        );
+    }
+    return self;
+}
+
+void team_drop(team_t* self) {
+    free(self->cpus);
+    self->cpus = NULL;
+}
+
+void team_pin(team_t const* self) {
+    usz const t = (usz)omp_get_thread_num();
+    usz const nb_threads = (usz)omp_get_num_threads();
+    usz slot;
+    switch (self->affinity) {
+        case TEAM_AFFINITY_NONE:
+            return;
+        case TEAM_AFFINITY_COMPACT:
+            slot = t % self->nb_cpus;
+            break;
+        case TEAM_AFFINITY_SPREAD:
+            slot = (nb_threads <= self->nb_cpus) ? t * self->nb_cpus / nb_threads
+                                                 : t % self->nb_cpus;
+            break;
+        default:
+            __builtin_unreachable();
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(self->cpus[slot], &set);
+    if (0 != sched_setaffinity(0, sizeof(set), &set)) {
+        warn("failed to pin thread %zu to CPU %d: %s", t, self->cpus[slot], strerror(errno));
+    }
+}
+
+void team_idle_barrier(MPI_Comm comm) {
+    MPI_Request request;
+    MPI_Ibarrier(comm, &request);
+    i32 done = 0;
+    MPI_Test(&request, &done, MPI_STATUS_IGNORE);
+    while (!done) {
+        nanosleep(&(struct timespec){.tv_nsec = 1000000}, NULL);
+        MPI_Test(&request, &done, MPI_STATUS_IGNORE);
+    }
+}
+
+void team_print(team_t const* self, i32 rank) {
+    static char const* AFFINITY_STR[] = {"none", "compact", "spread"};
+    char progress[16] = "-";
+    if (self->progress_cpu >= 0) {
+        snprintf(progress, sizeof(progress), "CPU %d", self->progress_cpu);
+    }
+    fprintf(
+        stderr,
+        "RANK %d:\n"
+        "  NODE RANK:  %d/%d\n"
+        "  THREADS:    %zu (%s affinity)\n"
+        "  CPUS:       %d..%d (%zu)\n"
+        "  PROGRESS:   %s\n",
+        rank,
+        self->node_rank,
+        self->node_size,
+        self->nb_threads,
+        AFFINITY_STR[self->affinity],
+        self->cpus[0],
+        self->cpus[self->nb_cpus - 1],
+        self->nb_cpus,
+        progress
+    );
+}
@@ -0,0 +1,429 @@
+#define _GNU_SOURCE
+
+#include "stencil/tune.h"
+
+#include "chrono.h"
+#include "logging.h"
+#include "stencil/team.h"
+
+#include <errno.h>
+#include <math.h>
+#include <omp.h>
+#include <stdio.h>
+#include <string.h>
+
+/// Number of timed iterations per candidate, the fastest one is kept.
+#define TUNE_NB_RUNS 3
+/// Maximum number of thread counts tried (the available threads, then halved every time).
+#define TUNE_NB_THREAD_COUNTS 4
+/// Edge (in cells) of the cubic mesh of the calibration sweep.
+#define TUNE_CALIBRATION_DIM 64
+/// Maximum length of a formatted tuning key.
+#define TUNE_KEY_LEN 256
+
+// Candidate tile sizes along each axis, in increasing order. Sizes larger than the mesh are
+// clamped to it.
+static usz const TILE_X_SIZES[] = {1, 2, 4, 8, 16};
+static usz const TILE_Y_SIZES[] = {4, 8, 16, 32, 64};
+static usz const TILE_Z_SIZES[] = {64, 128, 256, 512, 1024};
+
+#define NB_SIZES(sizes) (sizeof(sizes) / sizeof((sizes)[0]))
+
+/// Meshes the candidates are timed on.
+typedef struct scratch_s {
+    mesh_t A;
+    mesh_t B;
+    mesh_t C;
+    mesh_t P;
+} scratch_t;
+
+/// Reads the model name of the CPU, falls back to "unknown".
+static void read_cpu_model(char model[static TUNE_CPU_MODEL_LEN]) {
+    strcpy(model, "unknown");
+    FILE* fp = fopen("/proc/cpuinfo", "rb");
+    if (NULL == fp) {
+        return;
+    }
+
+    usz line_len = 0;
+    char* line = NULL;
+    while (-1 != getline(&line, &line_len, fp)) {
+        char* sep = strchr(line, ':');
+        if (0 == strncmp("model name", line, strlen("model name")) && NULL != sep) {
+            sep += 1 + strspn(sep + 1, " \t");
+            sep[strcspn(sep, "\n")] = '\0';
+            snprintf(model, TUNE_CPU_MODEL_LEN, "%s", sep);
+            break;
+        }
+    }
+    free(line);
+    fclose(fp);
+
+    // The separator of the cache entries cannot appear in a key
+    for (char* c = strchr(model, ';'); NULL != c; c = strchr(c, ';')) {
+        *c = ',';
+    }
+}
+
+static char const* sweep_as_str(tune_key_t const* key) {
+    if (SOLVE_SWEEP_STREAMING == key->sweep) {
+        return "streaming";
+    }
+    return key->product ? "product" : "blocked";
+}
+
+tune_key_t tune_key_new(
+    solver_t const* solver,
+    solve_sweep_t sweep,
+    bool product,
+    usz dim_x,
+    usz dim_y,
+    usz dim_z,
+    usz nb_threads
+) {
+    tune_key_t self = {
+        .kernel = solver->kernel->name,
+        .order = solver->kernel->order,
+        .sweep = sweep,
+        .product = product,
+        .dim_x = dim_x,
+        .dim_y = dim_y,
+        .dim_z = dim_z,
+        .nb_threads = nb_threads,
+    };
+    read_cpu_model(self.cpu_model);
+    return self;
+}
+
+/// Formats the fields of `key`, which prefix its entries in the cache.
+static void format_key(tune_key_t const* key, char* buf, usz len) {
+    snprintf(
+        buf,
+        len,
+        "%s;%s;%zu;%s;%zu;%zu;%zu;%zu;",
+        key->cpu_model,
+        key->kernel,
+        key->order,
+        sweep_as_str(key),
+        key->dim_x,
+        key->dim_y,
+        key->dim_z,
+        key->nb_threads
+    );
+}
+
+bool tune_cache_lookup(char const path[static 1], tune_key_t const* key, tune_params_t* params) {
+    FILE* fp = fopen(path, "rb");
+    if (NULL == fp) {
+        return false;
+    }
+
+    char prefix[TUNE_KEY_LEN];
+    format_key(key, prefix, sizeof(prefix));
+    usz const prefix_len = strlen(prefix);
+
+    bool found = false;
+    usz line_len = 0;
+    char* line = NULL;
+    while (-1 != getline(&line, &line_len, fp)) {
+        if ('#' == line[0] || 0 != strncmp(prefix, line, prefix_len)) {
+            continue;
+        }
+        tune_params_t entry;
+        if (4 == sscanf(
+                     line + prefix_len,
+                     "%zu;%zu;%zu;%zu",
+                     &entry.tile.x,
+                     &entry.tile.y,
+                     &entry.tile.z,
+                     &entry.nb_threads
+                 ) &&
+            entry.tile.x > 0 && entry.tile.y > 0 && entry.tile.z > 0 && entry.nb_threads > 0) {
+            *params = entry;
+            found = true;
+        }
+    }
+    free(line);
+    fclose(fp);
+    return found;
+}
+
+void tune_cache_store(char const path[static 1], tune_key_t const* key, tune_params_t const* params) {
+    FILE* fp = fopen(path, "ab");
+    if (NULL == fp) {
+        warn("failed to open tuning cache `%s`: %s", path, strerror(errno));
+        return;
+    }
+
+    if (0 == ftell(fp)) {
+        fprintf(
+            fp,
+            "# cpu_model;kernel;order;sweep;dim_x;dim_y;dim_z;threads;tile_x;tile_y;tile_z;best_threads\n"
+        );
+    }
+    char prefix[TUNE_KEY_LEN];
+    format_key(key, prefix, sizeof(prefix));
+    fprintf(
+        fp,
+        "%s%zu;%zu;%zu;%zu\n",
+        prefix,
+        params->tile.x,
+        params->tile.y,
+        params->tile.z,
+        params->nb_threads
+    );
+    fclose(fp);
+}
+
+/// Allocates a scratch mesh of the local dimensions and fills it with a constant, which also
+/// places its pages.
+static mesh_t scratch_mesh(tune_key_t const* key, mesh_kind_t kind, mesh_alloc_t alloc) {
+    mesh_t mesh = mesh_new(key->dim_x, key->dim_y, key->dim_z, key->order, 1, kind, alloc);
+    #pragma omp parallel for collapse(2) schedule(static)
+    for (usz i = 0; i < mesh.dim_x; ++i) {
+        for (usz j = 0; j < mesh.dim_y; ++j) {
+            for (usz k = 0; k < mesh.dim_z; ++k) {
+                *idx(&mesh, i, j, k) = 1.0;
+            }
+        }
+    }
+    return mesh;
+}
+
+/// Returns the time (in seconds) of the fastest of `TUNE_NB_RUNS` iterations with `solver`.
+static f64 time_iteration(solver_t const* solver, tune_key_t const* key, scratch_t* scratch) {
+    f64 best = INFINITY;
+    for (usz r = 0; r < TUNE_NB_RUNS; ++r) {
+        chrono_t chrono;
+        chrono_start(&chrono);
+        #pragma omp parallel
+        {
+            if (SOLVE_SWEEP_STREAMING == key->sweep) {
+                solve_jacobi_streaming(solver, &scratch->A, &scratch->B, &scratch->C);
+            } else if (key->product) {
+                solve_product(solver, &scratch->A, &scratch->B, &scratch->P);
+                solve_jacobi_product(solver, &scratch->P, &scratch->C);
+            } else {
+                solve_jacobi(solver, &scratch->A, &scratch->B, &scratch->C);
+            }
+        }
+        chrono_stop(&chrono);
+
+        f64 const elapsed = duration_as_s_f64(chrono_elapsed(chrono));
+        best = (elapsed < best) ? elapsed : best;
+    }
+    return best;
+}
+
+/// Tries the candidate `sizes` for the tile size pointed to by `axis` (a field of the tile of
+/// `candidate`), other sizes staying at their best values.
+static void search_tile_axis(
+    solver_t* candidate,
+    usz* axis,
+    usz const* sizes,
+    usz nb_sizes,
+    usz dim,
+    tune_key_t const* key,
+    scratch_t* scratch,
+    tune_params_t* best,
+    f64* best_time
+) {
+    candidate->tile = best->tile;
+    usz prev = 0;
+    for (usz s = 0; s < nb_sizes; ++s) {
+        usz const size = (sizes[s] < dim) ? sizes[s] : dim;
+        if (size == prev) {
+            continue;
+        }
+        prev = size;
+
+        *axis = size;
+        f64 const time = time_iteration(candidate, key, scratch);
+        if (time < *best_time) {
+            *best_time = time;
+            best->tile = candidate->tile;
+        }
+    }
+    candidate->tile = best->tile;
+}
+
+tune_params_t tune_search(solver_t const* solver, tune_key_t const* key, mesh_alloc_t alloc) {
+    scratch_t scratch = {
+        .A = scratch_mesh(key, MESH_KIND_INPUT, alloc),
+        .B = scratch_mesh(key, MESH_KIND_CONSTANT, alloc),
+        .C = scratch_mesh(key, MESH_KIND_OUTPUT, alloc),
+    };
+    if (key->product && SOLVE_SWEEP_BLOCKED == key->sweep) {
+        scratch.P = scratch_mesh(key, MESH_KIND_PRODUCT, alloc);
+    }
+
+    solver_t candidate = *solver;
+    tune_params_t best = {
+        .tile = solver->tile,
+        .nb_threads = key->nb_threads,
+    };
+    f64 best_time = INFINITY;
+
+    // Thread count, with the initial tile shape
+    usz nb_threads = key->nb_threads;
+    for (usz t = 0; t < TUNE_NB_THREAD_COUNTS && nb_threads > 0; ++t, nb_threads /= 2) {
+        omp_set_num_threads((i32)nb_threads);
+        f64 const time = time_iteration(&candidate, key, &scratch);
+        if (time < best_time) {
+            best_time = time;
+            best.nb_threads = nb_threads;
+        }
+    }
+    omp_set_num_threads((i32)best.nb_threads);
+
+    // Tile shape, one axis at a time starting with the unit-stride one
+    if (SOLVE_SWEEP_BLOCKED == key->sweep) {
+        search_tile_axis(
+            &candidate,
+            &candidate.tile.z,
+            TILE_Z_SIZES,
+            NB_SIZES(TILE_Z_SIZES),
+            key->dim_z,
+            key,
+            &scratch,
+            &best,
+            &best_time
+        );
+        search_tile_axis(
+            &candidate,
+            &candidate.tile.y,
+            TILE_Y_SIZES,
+            NB_SIZES(TILE_Y_SIZES),
+            key->dim_y,
+            key,
+            &scratch,
+            &best,
+            &best_time
+        );
+        search_tile_axis(
+            &candidate,
+            &candidate.tile.x,
+            TILE_X_SIZES,
+            NB_SIZES(TILE_X_SIZES),
+            key->dim_x,
+            key,
+            &scratch,
+            &best,
+            &best_time
+        );
+    }
+
+    omp_set_num_threads((i32)key->nb_threads);
+    mesh_drop(&scratch.A);
+    mesh_drop(&scratch.B);
+    mesh_drop(&scratch.C);
+    mesh_drop(&scratch.P);
+    return best;
+}
+
+f64 tune_calibrate(solver_t const* solver, usz nb_threads, mesh_alloc_t alloc) {
+    tune_key_t const key = tune_key_new(
+        solver,
+        SOLVE_SWEEP_BLOCKED,
+        false,
+        TUNE_CALIBRATION_DIM,
+        TUNE_CALIBRATION_DIM,
+        TUNE_CALIBRATION_DIM,
+        nb_threads
+    );
+    scratch_t scratch = {
+        .A = scratch_mesh(&key, MESH_KIND_INPUT, alloc),
+        .B = scratch_mesh(&key, MESH_KIND_CONSTANT, alloc),
+        .C = scratch_mesh(&key, MESH_KIND_OUTPUT, alloc),
+    };
+
+    omp_set_num_threads((i32)nb_threads);
+    f64 const time = time_iteration(solver, &key, &scratch);
+    mesh_drop(&scratch.A);
+    mesh_drop(&scratch.B);
+    mesh_drop(&scratch.C);
+    return (f64)(key.dim_x * key.dim_y * key.dim_z) / time;
+}
+
+tune_params_t tune_shared(
+    MPI_Comm comm,
+    solver_t const* solver,
+    tune_key_t const* key,
+    char const path[static 1],
+    mesh_alloc_t alloc,
+    bool force
+) {
+    i32 rank;
+    i32 size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    // The keys of all ranks are compared in their cache format, each rank is served by the lowest
+    // rank with the same key
+    char* keys = malloc((usz)size * TUNE_KEY_LEN);
+    char local[TUNE_KEY_LEN] = {0};
+    format_key(key, local, sizeof(local));
+    MPI_Allgather(local, TUNE_KEY_LEN, MPI_CHAR, keys, TUNE_KEY_LEN, MPI_CHAR, comm);
+    i32 leader = rank;
+    for (i32 r = 0; r < rank; ++r) {
+        if (0 == strcmp(local, keys + (usz)r * TUNE_KEY_LEN)) {
+            leader = r;
+            break;
+        }
+    }
+    free(keys);
+
+    // Leaders look up their key, those that missed the cache search it
+    tune_params_t params = {0};
+    bool const cached = leader == rank && !force && tune_cache_lookup(path, key, &params);
+    i32 const searching = (leader == rank && !cached) ? 1 : 0;
+    i32 any_searching = 0;
+    MPI_Allreduce(&searching, &any_searching, 1, MPI_INT, MPI_LOR, comm);
+    if (any_searching) {
+        // Only the searches of a node compete for its CPUs, they run one after the other while the
+        // other ranks of the node sleep
+        MPI_Comm node_comm;
+        MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node_comm);
+        i32 node_rank;
+        i32 node_size;
+        MPI_Comm_rank(node_comm, &node_rank);
+        MPI_Comm_size(node_comm, &node_size);
+        i32* node_searching = malloc((usz)node_size * sizeof(i32));
+        MPI_Allgather(&searching, 1, MPI_INT, node_searching, 1, MPI_INT, node_comm);
+        for (i32 r = 0; r < node_size; ++r) {
+            if (!node_searching[r]) {
+                continue;
+            }
+            if (r == node_rank) {
+                info("rank %d tuning tile shape and thread count on %s", rank, key->cpu_model);
+                params = tune_search(solver, key, alloc);
+                tune_cache_store(path, key, &params);
+            }
+            team_idle_barrier(node_comm);
+        }
+        free(node_searching);
+        MPI_Comm_free(&node_comm);
+    }
+    if (leader == rank) {
+        info(
+            "rank %d %s tile shape %zux%zux%zu with %zu threads for %zux%zux%zu cells",
+            rank,
+            cached ? "using cached" : "tuned",
+            params.tile.x,
+            params.tile.y,
+            params.tile.z,
+            params.nb_threads,
+            key->dim_x,
+            key->dim_y,
+            key->dim_z
+        );
+    }
+
+    tune_params_t* all = malloc((usz)size * sizeof(tune_params_t));
+    MPI_Allgather(
+        &params, sizeof(tune_params_t), MPI_BYTE, all, sizeof(tune_params_t), MPI_BYTE, comm
+    );
+    params = all[leader];
+    free(all);
+    return params;
+}